@@ -0,0 +1,380 @@
+// ff benchmark driver
+//
+// Builds ff's own translation unit with its main() renamed, generates
+// synthetic corpora in memory and times the hot paths directly:
+//
+//   ff_bench [LINES...]              run every benchmark on every corpus
+//   ff_bench gen CORPUS LINES        write a corpus to stdout
+//
+// Corpora: paths (deep file lists), ansi (ls --color / bat style output),
+// grep (file:line:content). Results are printed one per line, tab separated,
+// under a header row, so runs from two builds can be joined and diffed.
+
+#define main ff_main
+#include "../src/main.c"
+#undef main
+
+static uint64_t rng_state = 0x9E3779B97F4A7C15ULL;
+
+static uint64_t rng_next(void) {
+    uint64_t x = rng_state;
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+    return rng_state = x;
+}
+
+static int rng_below(int n) {
+    return (int)(rng_next() % (uint64_t)n);
+}
+
+static const char *const words[] = {
+    "src", "lib", "include", "test", "tests", "vendor", "build", "docs", "core", "util",
+    "net", "http", "server", "client", "config", "parser", "lexer", "render", "widget", "layout",
+    "main", "index", "app", "model", "view", "controller", "service", "handler", "store", "cache",
+    "buffer", "stream", "reader", "writer", "queue", "worker", "pool", "thread", "event", "loop",
+    "UserAccount", "HttpRequest", "fileSystem", "readLine", "camelCase", "snake_case", "v2", "x86_64",
+};
+#define WORD_COUNT ((int)(sizeof(words) / sizeof(words[0])))
+
+static const char *const exts[] = { ".c", ".h", ".rs", ".go", ".py", ".js", ".md", ".txt", ".json", "" };
+#define EXT_COUNT ((int)(sizeof(exts) / sizeof(exts[0])))
+
+typedef struct {
+    char *data;
+    size_t len;
+    size_t cap;
+} Buf;
+
+static void buf_put(Buf *b, const char *s, size_t n) {
+    if (b->len + n + 1 > b->cap) {
+        size_t cap = b->cap ? b->cap : (1u << 20);
+        while (b->len + n + 1 > cap) cap *= 2;
+        char *data = (char*)realloc(b->data, cap);
+        if (!data) {
+            fprintf(stderr, "bench: out of memory\n");
+            exit(1);
+        }
+        b->data = data;
+        b->cap = cap;
+    }
+    memcpy(b->data + b->len, s, n);
+    b->len += n;
+}
+
+static void buf_puts(Buf *b, const char *s) {
+    buf_put(b, s, strlen(s));
+}
+
+static void buf_path(Buf *b) {
+    int depth = 2 + rng_below(9);
+    for (int d = 0; d < depth; d++) {
+        buf_puts(b, words[rng_below(WORD_COUNT)]);
+        buf_put(b, "/", 1);
+    }
+    buf_puts(b, words[rng_below(WORD_COUNT)]);
+    buf_puts(b, exts[rng_below(EXT_COUNT)]);
+}
+
+static void gen_paths(Buf *b, int lines) {
+    for (int i = 0; i < lines; i++) {
+        buf_path(b);
+        buf_put(b, "\n", 1);
+    }
+}
+
+// Alternates ls --color style entries with bat style highlighted source.
+static void gen_ansi(Buf *b, int lines) {
+    static const char *const colors[] = {
+        "\033[01;34m", "\033[01;32m", "\033[38;5;81m", "\033[38;5;149m",
+        "\033[38;2;249;38;114m", "\033[33m", "\033[1;31m",
+    };
+    int ncolors = (int)(sizeof(colors) / sizeof(colors[0]));
+    char num[32];
+
+    for (int i = 0; i < lines; i++) {
+        if (i & 1) {
+            buf_puts(b, colors[rng_below(ncolors)]);
+            buf_puts(b, words[rng_below(WORD_COUNT)]);
+            buf_puts(b, exts[rng_below(EXT_COUNT)]);
+            buf_puts(b, "\033[0m");
+        } else {
+            snprintf(num, sizeof(num), "\033[38;5;238m%6d\033[0m  ", i);
+            buf_puts(b, num);
+            int tokens = 3 + rng_below(8);
+            for (int t = 0; t < tokens; t++) {
+                buf_puts(b, colors[rng_below(ncolors)]);
+                buf_puts(b, words[rng_below(WORD_COUNT)]);
+                buf_puts(b, "\033[0m");
+                buf_puts(b, t + 1 < tokens ? (rng_below(3) ? " " : "(") : ";");
+            }
+        }
+        buf_put(b, "\n", 1);
+    }
+}
+
+static void gen_grep(Buf *b, int lines) {
+    char num[32];
+    for (int i = 0; i < lines; i++) {
+        buf_path(b);
+        snprintf(num, sizeof(num), ":%d:", 1 + rng_below(5000));
+        buf_puts(b, num);
+        int tokens = 2 + rng_below(12);
+        for (int t = 0; t < tokens; t++) {
+            if (rng_below(40) == 0) buf_puts(b, "TODO ");
+            buf_puts(b, words[rng_below(WORD_COUNT)]);
+            buf_put(b, " ", 1);
+        }
+        buf_put(b, "\n", 1);
+    }
+}
+
+typedef struct {
+    const char *name;
+    void (*gen)(Buf *b, int lines);
+    const char *fuzzy;
+    const char *exact;
+    const char *regex;
+} Corpus;
+
+static const Corpus corpora[] = {
+    { "paths", gen_paths, "srcmainc",  "reader",  "^src/.*\\.c$" },
+    { "ansi",  gen_ansi,  "httprq",    "Request", "[A-Z][a-z]+[A-Z]" },
+    { "grep",  gen_grep,  "todocache", "TODO",    ":[0-9]+:.*TODO" },
+};
+#define CORPUS_COUNT ((int)(sizeof(corpora) / sizeof(corpora[0])))
+
+static void report(const char *bench, const char *corpus, int lines, int ops,
+                   double total_us, double max_us, uint64_t bytes) {
+    printf("%s\t%s\t%d\t%d\t%.3f\t%.3f\t%.3f\t%llu\n",
+           bench, corpus, lines, ops, total_us / 1e3,
+           ops > 0 ? total_us / ops : 0.0, max_us, (unsigned long long)bytes);
+    fflush(stdout);
+}
+
+static FuzzyState *bench_state(void) {
+    FuzzyState *st = (FuzzyState*)calloc(1, sizeof(FuzzyState));
+    if (!st) {
+        fprintf(stderr, "bench: out of memory\n");
+        exit(1);
+    }
+    st->match_mode = MATCH_FUZZY;
+    st->algo = ALGO_V1;
+    st->span_gen = 1;
+    st->dir_fd = -1;
+    st->live_interval_ms = 1000;
+    return st;
+}
+
+// Types the query one key at a time, then deletes it again, timing each
+// update_matches round the way the UI would drive it.
+static void bench_keystrokes(FuzzyState *st, const char *bench, const char *corpus,
+                             MatchMode mode, const char *query) {
+    clear_query(st);
+    st->match_mode = mode;
+
+    double total = 0, worst = 0;
+    int ops = 0;
+
+    for (const char *q = query; *q; q++) {
+        double t0 = now_us();
+        add_char(st, *q);
+        double dt = now_us() - t0;
+        total += dt;
+        if (dt > worst) worst = dt;
+        ops++;
+    }
+    report(bench, corpus, st->line_count, ops, total, worst, 0);
+
+    char name[64];
+    snprintf(name, sizeof(name), "%s_backspace", bench);
+    total = worst = 0;
+    ops = 0;
+    while (st->query_len > 0) {
+        double t0 = now_us();
+        delete_char(st);
+        double dt = now_us() - t0;
+        total += dt;
+        if (dt > worst) worst = dt;
+        ops++;
+    }
+    report(name, corpus, st->line_count, ops, total, worst, 0);
+}
+
+static void bench_corpus(const Corpus *c, int lines, int draw_ok) {
+    rng_state = 0x9E3779B97F4A7C15ULL ^ (uint64_t)lines;
+
+    Buf b = {0};
+    c->gen(&b, lines);
+
+    // load_stream: from a temporary file through the block reader.
+    FILE *fp = tmpfile();
+    if (!fp || fwrite(b.data, 1, b.len, fp) != b.len) {
+        fprintf(stderr, "bench: failed to write corpus\n");
+        exit(1);
+    }
+    fflush(fp);
+    rewind(fp);
+
+    FuzzyState *st = bench_state();
+    double t0 = now_us();
+    load_stream(st, fp);
+    double dt = now_us() - t0;
+    fclose(fp);
+    report("load_stream", c->name, st->line_count, 1, dt, dt, b.len);
+
+    // strip_ansi over every raw line.
+    {
+        char *out = (char*)malloc(b.len + 1);
+        uint64_t bytes = 0;
+        t0 = now_us();
+        for (int i = 0; i < st->line_count; i++) {
+            const LineRec *rec = store_rec(&st->store, i);
+            strip_ansi(line_raw(st, i), out, rec->raw_len + 1);
+            bytes += rec->raw_len;
+        }
+        dt = now_us() - t0;
+        free(out);
+        report("strip_ansi", c->name, st->line_count, st->line_count, dt, 0, bytes);
+    }
+
+    bench_keystrokes(st, "fuzzy", c->name, MATCH_FUZZY, c->fuzzy);
+
+    st->algo = ALGO_V2;
+    bench_keystrokes(st, "fuzzy_v2", c->name, MATCH_FUZZY, c->fuzzy);
+    st->algo = ALGO_V1;
+
+    bench_keystrokes(st, "exact", c->name, MATCH_EXACT, c->exact);
+    bench_keystrokes(st, "regex", c->name, MATCH_REGEX, c->regex);
+
+    // Sorting: a one-letter exact query matches most lines; time ranking
+    // the lazy prefix out to the end and a full sort from scratch.
+    clear_query(st);
+    st->match_mode = MATCH_EXACT;
+    add_char(st, 'e');
+    {
+        t0 = now_us();
+        ensure_sorted(st, st->match_count);
+        dt = now_us() - t0;
+        report("ensure_sorted_all", c->name, st->match_count, 1, dt, dt, 0);
+
+        int *copy = (int*)malloc((size_t)(st->match_count + 1) * sizeof(int));
+        memcpy(copy, st->match_indices, (size_t)st->match_count * sizeof(int));
+        for (int i = st->match_count - 1; i > 0; i--) {
+            int j = rng_below(i + 1);
+            int t = copy[i]; copy[i] = copy[j]; copy[j] = t;
+        }
+        t0 = now_us();
+        sort_matches(st, copy, st->match_count);
+        dt = now_us() - t0;
+        free(copy);
+        report("sort_full", c->name, st->match_count, 1, dt, dt, 0);
+    }
+
+    // draw_results against a terminal that writes to /dev/null: one frame
+    // per selection step so every frame has real damage.
+    if (draw_ok) {
+        clear_query(st);
+        st->match_mode = MATCH_FUZZY;
+        add_char(st, c->fuzzy[0]);
+        add_char(st, c->fuzzy[1]);
+        st->ansi_render = 0;
+        for (int i = 0; i < st->line_count && !st->ansi_render; i++) {
+            const LineRec *rec = store_rec(&st->store, i);
+            if (rec->plain_len != rec->raw_len) st->ansi_render = 1;
+        }
+
+        int frames = 200;
+        double worst = 0;
+        double total = 0;
+        for (int f = 0; f < frames; f++) {
+            t0 = now_us();
+            draw_ui(st);
+            dt = now_us() - t0;
+            total += dt;
+            if (dt > worst) worst = dt;
+            move_down(st);
+        }
+        report("draw_frame", c->name, st->line_count, frames, total, worst, 0);
+
+        // The same frames with nothing on screen to reuse, as after a resize.
+        worst = 0;
+        total = 0;
+        for (int f = 0; f < frames; f++) {
+            t0 = now_us();
+            invalidate_screen(st);
+            draw_ui(st);
+            dt = now_us() - t0;
+            total += dt;
+            if (dt > worst) worst = dt;
+            move_up(st);
+        }
+        report("draw_full", c->name, st->line_count, frames, total, worst, 0);
+    }
+
+    free_state(st);
+    free(st);
+    free(b.data);
+}
+
+int main(int argc, char **argv) {
+    simd_init();
+
+    if (argc >= 2 && strcmp(argv[1], "gen") == 0) {
+        if (argc != 4) {
+            fprintf(stderr, "usage: %s gen paths|ansi|grep LINES\n", argv[0]);
+            return 2;
+        }
+        for (int i = 0; i < CORPUS_COUNT; i++) {
+            if (strcmp(argv[2], corpora[i].name) != 0) continue;
+            Buf b = {0};
+            corpora[i].gen(&b, atoi(argv[3]));
+            fwrite(b.data, 1, b.len, stdout);
+            free(b.data);
+            return 0;
+        }
+        fprintf(stderr, "bench: unknown corpus '%s'\n", argv[2]);
+        return 2;
+    }
+
+    int sizes[32];
+    int nsizes = 0;
+    for (int i = 1; i < argc && nsizes < 32; i++) {
+        int n = atoi(argv[i]);
+        if (n > 0) sizes[nsizes++] = n;
+    }
+    if (nsizes == 0) {
+        sizes[nsizes++] = 10000;
+        sizes[nsizes++] = 1000000;
+    }
+
+    // A null terminal: real ncurses output, discarded.
+    FILE *null_out = fopen("/dev/null", "w");
+    FILE *null_in = fopen("/dev/null", "r");
+    const char *term = getenv("TERM");
+    SCREEN *scr = NULL;
+    if (null_out && null_in) {
+        scr = newterm(term && *term && strcmp(term, "dumb") != 0 ? term : "xterm-256color",
+                      null_out, null_in);
+    }
+    if (scr) {
+        set_term(scr);
+        resize_term(50, 200);
+        init_colors();
+    } else {
+        fprintf(stderr, "bench: no terminal description, skipping draw_frame\n");
+    }
+
+    printf("bench\tcorpus\tlines\tops\ttotal_ms\tmean_us\tmax_us\tbytes\n");
+    for (int s = 0; s < nsizes; s++) {
+        for (int c = 0; c < CORPUS_COUNT; c++) bench_corpus(&corpora[c], sizes[s], scr != NULL);
+    }
+
+    if (scr) {
+        endwin();
+        delscreen(scr);
+    }
+    if (null_out) fclose(null_out);
+    if (null_in) fclose(null_in);
+    return 0;
+}
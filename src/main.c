@@ -1,6 +1,7 @@
 // ff fuzzy filter
 #define _POSIX_C_SOURCE 200809L
 #define _DARWIN_C_SOURCE
+#define _DEFAULT_SOURCE
 
 
 #include <ncurses.h>
@@ -14,6 +15,9 @@
 #include <errno.h>
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <signal.h>
 #include <strings.h>
 #include <sys/wait.h>
 #include <dirent.h>
@@ -23,9 +27,33 @@
 #include <sys/time.h>
 #include <stdbool.h>
 #include <stdint.h>
+#include <pthread.h>
+#include <poll.h>
+#include <fnmatch.h>
+
+#if defined(__linux__)
+#include <sys/vfs.h>
+#endif
+
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+#include <immintrin.h>
+#define FF_HAVE_X86_SIMD 1
+#endif
 
 #define MAX_LINE_LEN 2048
-#define MAX_LINES 2000
+
+// Lines live in fixed-size chunks reached through a directory that is
+// allocated once and never moved, so a line's record address is stable.
+#define LINE_CHUNK_SHIFT 16
+#define LINE_CHUNK_SIZE  (1 << LINE_CHUNK_SHIFT)
+#define LINE_CHUNK_MASK  (LINE_CHUNK_SIZE - 1)
+#define LINE_CHUNK_MAX   4096
+
+// Line bytes are packed into large arena slabs. Lines longer than a slab get a
+// slab of their own; the slab directory is also fixed so pointers stay valid.
+#define ARENA_SLAB_SIZE  (4u << 20)
+#define ARENA_SLAB_MAX   16384
+#define ARENA_LINE_MAX   (1u << 30)
 
 #define COLOR_NORMAL     1
 #define COLOR_SELECTED   2
@@ -37,6 +65,19 @@
 
 #define ANSI_PAIR_BASE  20
 
+// Score for a line that cannot match at all (as opposed to a fuzzy match whose
+// length penalty pushed it below zero, which a longer query may still accept).
+#define SCORE_NONE INT_MIN
+
+// Ranking only orders the best RANK_TOPK matches up front; the sorted prefix
+// is extended on demand as the view scrolls past it.
+#define RANK_TOPK 512
+
+// Per-prefix result sets kept for incremental narrowing. Levels are skipped
+// rather than cached once the stack holds this many candidate entries.
+#define MATCH_CACHE_DEPTH       64
+#define MATCH_CACHE_MAX_ENTRIES (16 * 1024 * 1024)
+
 typedef enum {
     MODE_NORMAL,
     MODE_INSERT
@@ -48,14 +89,441 @@ typedef enum {
     MATCH_REGEX
 } MatchMode;
 
+// Fuzzy scoring engine: v1 is the greedy leftmost walk, v2 the optimal
+// alignment (--algo=v2).
+typedef enum {
+    ALGO_V1,
+    ALGO_V2
+} FuzzyAlgo;
+
+// raw and plain are stored back to back in one slab; a line without escape
+// sequences has plain_len == raw_len and both views share the same bytes.
+// sig has one bit per (case-folded) character class present in plain.
+// flags carries per-line display state (LINE_EXEC*); slab indices fit in 16
+// bits (ARENA_SLAB_MAX), which keeps the record at 24 bytes.
+typedef struct {
+    uint16_t slab;
+    uint16_t flags;
+    uint32_t off;
+    uint32_t raw_len;
+    uint32_t plain_len;
+    uint64_t sig;
+} LineRec;
+
+// -D entries that are plain files: whether they are executable is looked up
+// only once the row is drawn, and shown as a trailing '*'.
+#define LINE_EXEC_PENDING 0x1
+#define LINE_EXEC         0x2
+
+typedef struct {
+    char **slabs;
+    uint32_t *slab_sizes;
+    int slab_count;
+    int cur;
+    uint32_t used;
+} Arena;
+
+typedef struct {
+    LineRec **chunks;
+    int chunk_count;
+    int count;
+    Arena arena;
+} LineStore;
+
+// v2 aligns within the window between the first occurrence of the query's
+// first character and the last occurrence of its last one. Windows with more
+// DP cells than this are scored along the greedy alignment instead.
+#define ALIGN_MAX_CELLS (128 * 1024)
+
+// DP matrices for v2, grown on demand and reused for every line.
+typedef struct {
+    int *score;
+    int *run_bonus;
+    signed char *bonus;
+    int cap;
+} AlignScratch;
+
+// Highlight positions of one line for the current query, as runs of
+// consecutive matched bytes in plain (escape-stripped) coordinates.
+typedef struct {
+    uint32_t start;
+    uint32_t len;
+} MatchSpan;
+
+// Spans are computed for rows as they become visible and cached in a small
+// direct-mapped table keyed by line index; gen ties an entry to the query,
+// mode and line set it was computed for.
+#define SPAN_CACHE_SLOTS 256
+
+typedef struct {
+    int line;
+    unsigned gen;
+    int count;
+    int cap;
+    MatchSpan *spans;
+} SpanEntry;
+
+// Scoring runs on a persistent worker pool once a scan covers this many lines;
+// work is handed out in chunks of POOL_GRAIN items.
+#define POOL_MAX_THREADS   64
+#define POOL_GRAIN         4096
+#define PARALLEL_MIN_LINES (4 * POOL_GRAIN)
+
+typedef struct {
+    // Chunk range still owned by this worker, packed as head << 32 | tail.
+    // The owner takes from the head, idle workers steal from the tail.
+    uint64_t deque;
+
+    int *matches;
+    int match_count;
+    int match_cap;
+    int sorted_count;
+    int *rejects;
+    int reject_count;
+    int reject_cap;
+    int failed;       // ran out of memory; its lists are incomplete
+
+    regex_t regex;
+    int regex_state;
+
+    AlignScratch align;
+} PoolWorker;
+
+typedef void (*PoolChunkFn)(void *ctx, PoolWorker *w, int begin, int end);
+typedef void (*PoolDoneFn)(void *ctx, PoolWorker *w);
+
+typedef struct {
+    pthread_t *threads;
+    PoolWorker *workers;
+    int nthreads;
+    int started;
+
+    pthread_mutex_t lock;
+    pthread_cond_t start_cv;
+    pthread_cond_t done_cv;
+    unsigned job_gen;
+    int pending;
+    int shutdown;
+
+    PoolChunkFn fn;
+    PoolDoneFn done_fn;
+    void *ctx;
+    int n;
+    int nchunks;
+    int grain;
+} WorkPool;
+
+// One cached result set for `query` over the first line_count lines. indices
+// holds the ranked matches first, then the remaining candidates: lines that
+// contain the query but scored below zero. Scores are kept alongside.
+typedef struct {
+    char query[256];
+    int query_len;
+    int line_count;
+    int *indices;
+    int *scores;
+    int count;
+    int match_count;
+    int sorted_count;
+} MatchLevel;
+
+// Stack of result sets for successive prefixes of the query. In fuzzy and
+// exact mode a line that lacks a prefix cannot contain the longer query, so
+// growing the query rescores the top level's candidates and shrinking it pops
+// back to a cached level.
+typedef struct {
+    MatchLevel levels[MATCH_CACHE_DEPTH];
+    int depth;
+    long entries;
+    MatchMode mode;
+    int case_sensitive;
+    unsigned store_gen;
+} MatchCache;
+
+// Background reader for stdin and file arguments. The reader thread is the
+// only writer of the line store while it runs; it publishes its line count
+// with a release store and the UI thread picks lines up to that count.
+//
+// The UI sleeps in poll() while nothing arrives. It arms `wake_armed` when it
+// is ready for more lines; the reader disarms it and writes a byte to the
+// wake pipe the next time it publishes, so a stalled pipe costs no wakeups
+// and a fast one at most one per frame.
+#define INGEST_FRAME_MS 30
+
+typedef struct {
+    pthread_t thread;
+    int active;
+    int done;
+    int published;
+    uint64_t bytes;
+    long started_ms;
+    long finished_ms;
+
+    int wake[2];
+    int wake_ready;
+    int wake_armed;
+    long adopted_ms;   // UI thread only: last time new lines were taken in
+
+    FILE **sources;
+    int *source_is_pipe;
+    int source_count;
+} Ingest;
+
+// -R source: a directory tree walked in parallel on the ingest thread. Each
+// walker owns a deque of directories still to read; it works depth-first
+// from the back while idle walkers steal from the front, where the shallow
+// and usually largest subtrees wait. Symlinks are followed, and every
+// directory is entered at most once by (dev, ino), so link loops end.
+#define WALK_MAX_THREADS 32
+#define WALK_FLUSH_BYTES (64 * 1024)
+#define WALK_FLUSH_MS    10
+#define WALK_SEEN_SHARDS 64
+
+typedef struct {
+    char *root;        // NULL unless -R was given
+    char *prefix;      // prepended to every path: "" or "root/"
+    int fd;            // the root, kept open for reloads
+    int max_depth;     // --depth; 0 means unlimited
+    char **excludes;   // --exclude patterns, matched against each name
+    int exclude_count;
+} WalkConfig;
+
+// -G source: the files are searched for the query each time it changes,
+// rather than loaded up front. A search runs on the ingest thread, files
+// spread over workers that map each one and stream matching lines into the
+// store as "file:line:content"; only hits are ever materialized. Files that
+// have a NUL in their first GREP_SNIFF_BYTES are taken as binary and skipped.
+#define GREP_MAX_THREADS  32
+#define GREP_SNIFF_BYTES  8192
+#define GREP_MAX_HITS     (1 << 20)
+#define GREP_FLUSH_BYTES  (64 * 1024)
+#define GREP_FLUSH_MS     10
+#define GREP_CANCEL_BYTES (1 << 20)
+#define GREP_SLURP_MAX    ((size_t)256 << 20)
+
+typedef struct {
+    char **files;      // the readable file arguments (owned by input_files)
+    int file_count;
+
+    // Pipes can only be read once, so those arguments are read in full up
+    // front and searched from here; NULL for regular files.
+    char **data;
+    size_t *data_len;
+
+    unsigned want;     // UI thread: bumped by every query or mode change
+    unsigned started;  // the request the current search answers
+
+    // Query as of the search in flight; the UI keeps editing its own copy.
+    char query[256];
+    int query_len;
+    MatchMode mode;
+    FuzzyAlgo algo;
+    int case_sensitive;
+
+    int cancel;
+    int files_done;
+    int hits;
+    int truncated;     // stopped at GREP_MAX_HITS
+} GrepConfig;
+
+// Latency samples in microseconds, kept for --stats percentiles.
+typedef struct {
+    uint32_t *us;
+    int count;
+    int cap;
+} LatencyLog;
+
+// Timings behind the Ctrl+T overlay and --stats.
+typedef struct {
+    int overlay;
+    int enabled;
+
+    long update_us;
+    long rank_us;
+    long frame_us;
+    long key_start_us;
+
+    LatencyLog keys;
+    LatencyLog updates;
+    LatencyLog frames;
+} Perf;
+
+// What one result row currently shows on screen. A row is repainted only
+// when the state it would be drawn from differs from this.
+typedef struct {
+    int line;
+    int selected;
+    int ansi;
+    unsigned span_gen;
+    unsigned store_gen;
+} RowState;
+
+// Last frame as drawn: per-row state, the scroll offset and size it was drawn
+// at, and the inputs of the status and separator lines.
+typedef struct {
+    RowState *rows;
+    int row_count;
+    int cols;
+    int scroll;
+    int valid;
+    char status[1024];
+    char separator[256];
+} ViewState;
+
+struct FuzzyState;
+
+// Background matcher for the interactive UI. Query edits bump `want` and
+// cancel the scan in flight; once the pending keys are drained the main loop
+// starts the next scan on `scan`, a private state with its own result arrays,
+// prefix cache and worker pool. A finished scan is published by swapping its
+// arrays with the live ones, so the renderer never sees a partial result.
+typedef struct {
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t cv;
+    int active;
+    int shutdown;
+
+    // UI thread only: a scan was started and not yet collected.
+    int busy;
+
+    // Under lock: `start` hands a scan to the thread, `finished` hands it
+    // back and `completed` says it ran to the end.
+    int start;
+    int finished;
+    int completed;
+    int cancel;
+
+    unsigned want;
+    unsigned job;
+    unsigned shown;
+
+    // >= 0 when the job only scores lines streamed in from here on, to be
+    // merged into the live results rather than replacing them.
+    int extend_from;
+
+    // Written when a scan finishes so the main loop can sleep in poll().
+    int wake[2];
+    struct FuzzyState *scan;
+} Matcher;
+
+// Remote commands are multiplexed over one OpenSSH control master per
+// user@host, so after the first connect every listing, cat and refresh is a
+// new channel on a live connection instead of a full handshake.
+typedef struct {
+    char dir[PATH_MAX];  // private directory holding the control sockets
+    int unavailable;     // couldn't create it; fall back to plain connections
+    char **targets;      // masters to shut down on exit
+    int target_count;
+    char home_target[520];
+    char *home;          // remote $HOME of home_target, looked up once
+} SshSession;
+
+// Recent remote -D listings keyed by (user@host, show_hidden, path), so
+// going back to a directory or toggling hidden files skips the network.
+// A background worker fills it ahead of the user: once the selection rests
+// on an entry for DIR_PREFETCH_DELAY_MS, the parent and (for directories)
+// the entry itself are fetched. Ctrl+R empties the cache.
+#define DIR_CACHE_TTL_MS      30000
+#define DIR_CACHE_MAX         64
+#define DIR_PREFETCH_DELAY_MS 150
+#define DIR_PREFETCH_QUEUE    8
+
+typedef struct {
+    char *key;
+    char *data;       // entries, each NUL-terminated
+    size_t len;
+    long fetched_ms;
+    int fetching;     // the worker is running this listing right now
+} DirCacheEntry;
+
+typedef struct {
+    char *key;
+    char *cmd;        // full ssh command line, built on the UI thread
+} DirPrefetchJob;
+
+typedef struct {
+    pthread_mutex_t lock;
+    pthread_cond_t cv;
+    DirCacheEntry entries[DIR_CACHE_MAX];
+    int count;
+    unsigned gen;     // bumped on invalidation; stale fetches are dropped
+
+    pthread_t thread;
+    int active;
+    int shutdown;
+    int busy;
+    DirPrefetchJob queue[DIR_PREFETCH_QUEUE];
+    int queued;
+
+    // Debounce state, UI thread only.
+    char hover[PATH_MAX + MAX_LINE_LEN];
+    long hover_ms;
+    int hover_done;
+} DirCache;
+
+// Block reader for line-oriented input. Pulls LINE_READER_BLOCK bytes at a
+// time with read() on the stream's descriptor and splits on '\n' with memchr;
+// a line longer than the buffer grows it, so lines have no length limit.
+// The FILE must not be read through stdio while a reader owns it.
+#define LINE_READER_BLOCK (256 * 1024)
+
+typedef struct LineReader {
+    int fd;
+    char *buf;
+    size_t cap;
+    size_t start;
+    size_t scan;
+    size_t end;
+    int eof;
+    uint64_t bytes;
+    // Called before each read() that may block, once the buffered lines
+    // have all been handed out.
+    void (*before_read)(void *arg);
+    void *before_read_arg;
+} LineReader;
+
+// A --live run in progress and the refresh being assembled from it.
+#define LIVE_POLL_LINES        4096
+#define LIVE_BACKOFF_MAX_SHIFT 2
+#define LIVE_STATUS_TICK_MS    250
+#define LIVE_STATUS_SHOW_MS    500
+
 typedef struct {
-    char *lines[MAX_LINES];
-    char *raw_lines[MAX_LINES];
+    pid_t pid;            // running command, 0 when idle
+    pid_t *reap;          // finished runs that still have to be waited for
+    int reap_count;
+    int reap_cap;
+    FILE *out;
+    LineReader reader;
+    long started_ms;
+    long run_ms;          // how long the last run took
+    long delay_ms;        // gap before the next one
+    long next_ms;
+    int idle_runs;        // runs in a row whose output didn't change
+    int rerun;            // refresh asked for while a run was going
+
+    uint64_t *hashes;     // hash of each line in the spare store
+    size_t hash_cap;
+    int seen;             // lines matched against the current ones so far
+    int same;             // output identical to the current lines up to seen
+    int failed;
+} LiveRun;
+
+typedef struct FuzzyState {
+    LineStore store;
+    LineStore spare_store;
+    unsigned store_gen;
     int line_count;
+    int line_cap;
 
     int *scores;
     int *match_indices;
     int match_count;
+    int sorted_count;
+    int *reject_indices;
+    int reject_count;
+    uint64_t query_sig;
 
     char query[256];
     int query_len;
@@ -71,21 +539,35 @@ typedef struct {
 
     char ssh_host[256];
     char ssh_user[256];
+    SshSession ssh;
+    // Allocated on first use and leaked if the prefetch worker is still
+    // fetching at exit, since it keeps writing to it.
+    DirCache *dir_cache;
 
     Mode mode;
     char current_dir[PATH_MAX];
 
     int is_directory_mode;
+    // Directory behind a local -D listing, for deferred fstatat lookups.
+    int dir_fd;
+    // Small pool for metadata lookups on network filesystems.
+    WorkPool stat_pool;
     int show_hidden;
     int ssh_mode;
 
     MatchMode match_mode;
+    FuzzyAlgo algo;
+    AlignScratch align;
     regex_t regex;
     int regex_valid;
     char regex_error[256];
 
+    SpanEntry span_cache[SPAN_CACHE_SLOTS];
+    unsigned span_gen;
+    regex_t span_regex;
+    int span_regex_state;
+
     char **source_files;
-    int *line_numbers;
     int source_file_count;
     int grep_mode;
 
@@ -96,16 +578,264 @@ typedef struct {
     int   live_mode;
     char *live_cmd;
     int   live_interval_ms;
-    long  last_live_refresh_ms;
+    LiveRun live;
+    // Hash of each current line, from the last --live refresh.
+    uint64_t *live_hashes;
+    int   live_hash_count;
+
+    WalkConfig walk;
+    GrepConfig grep;
 
     int ansi_render;
+
+    MatchCache match_cache;
+    Ingest ingest;
+
+    int threads;
+    WorkPool pool;
+
+    // Headless --filter run: rank once, print, never touch the terminal.
+    int filter_mode;
+    int filter_limit;
+    int count_only;
+
+    Perf perf;
+    ViewState view;
+
+    Matcher matcher;
+    // Set on the matcher's private state; scans poll it to stop early.
+    const int *cancel;
 } FuzzyState;
 
 static void load_stream(FuzzyState *st, FILE *fp);
 static void update_matches(FuzzyState *st);
+static void refresh_live_command(FuzzyState *st);
+static void live_stop(FuzzyState *st);
+static void matcher_stop(FuzzyState *st);
+static void ensure_sorted(FuzzyState *st, int upto);
+static int compare_scores(const void *a, const void *b, void *state);
 static void ensure_visible(FuzzyState *st);
 static char *quote_dash_safe(const char *path);
-static FILE *ssh_popen(const char *user, const char *host, const char *command);
+static FILE *ssh_popen(FuzzyState *st, const char *user, const char *host, const char *command);
+static void ssh_target(const char *user, const char *host, char *out, size_t size);
+
+static int strip_ansi(const char *in, char *out, size_t out_cap);
+static uint64_t char_signature(const char *s, size_t len);
+
+static inline const LineRec *store_rec(const LineStore *ls, int idx) {
+    return &ls->chunks[idx >> LINE_CHUNK_SHIFT][idx & LINE_CHUNK_MASK];
+}
+
+static inline LineRec *store_rec_mut(LineStore *ls, int idx) {
+    return &ls->chunks[idx >> LINE_CHUNK_SHIFT][idx & LINE_CHUNK_MASK];
+}
+
+static inline const char *store_raw(const LineStore *ls, int idx) {
+    const LineRec *rec = store_rec(ls, idx);
+    return ls->arena.slabs[rec->slab] + rec->off;
+}
+
+static inline const char *store_plain(const LineStore *ls, int idx) {
+    const LineRec *rec = store_rec(ls, idx);
+    const char *raw = ls->arena.slabs[rec->slab] + rec->off;
+    return rec->plain_len == rec->raw_len ? raw : raw + rec->raw_len + 1;
+}
+
+static inline const char *line_plain(const FuzzyState *st, int idx) {
+    return store_plain(&st->store, idx);
+}
+
+static inline const char *line_raw(const FuzzyState *st, int idx) {
+    return store_raw(&st->store, idx);
+}
+
+// Returns room for `need` bytes in the current slab, moving to (or recycling)
+// the next slab when it does not fit. Nothing is committed until arena_commit.
+static char *arena_reserve(Arena *a, uint32_t need) {
+    if (!a->slabs) {
+        a->slabs = (char**)calloc(ARENA_SLAB_MAX, sizeof(char*));
+        a->slab_sizes = (uint32_t*)calloc(ARENA_SLAB_MAX, sizeof(uint32_t));
+        if (!a->slabs || !a->slab_sizes) {
+            free(a->slabs);
+            free(a->slab_sizes);
+            a->slabs = NULL;
+            a->slab_sizes = NULL;
+            return NULL;
+        }
+    }
+
+    if (a->slab_count > 0 && a->slab_sizes[a->cur] - a->used >= need) {
+        return a->slabs[a->cur] + a->used;
+    }
+
+    int next = a->slab_count > 0 ? a->cur + 1 : 0;
+    if (next >= ARENA_SLAB_MAX) return NULL;
+
+    if (next < a->slab_count && a->slab_sizes[next] < need) {
+        free(a->slabs[next]);
+        a->slabs[next] = NULL;
+        a->slab_sizes[next] = 0;
+    }
+
+    if (!a->slabs[next]) {
+        uint32_t size = need > ARENA_SLAB_SIZE ? need : ARENA_SLAB_SIZE;
+        a->slabs[next] = (char*)malloc(size);
+        if (!a->slabs[next]) return NULL;
+        a->slab_sizes[next] = size;
+        if (next >= a->slab_count) a->slab_count = next + 1;
+    }
+
+    a->cur = next;
+    a->used = 0;
+    return a->slabs[next];
+}
+
+static void arena_commit(Arena *a, uint32_t bytes) {
+    a->used += bytes;
+}
+
+static void arena_reset(Arena *a) {
+    a->cur = 0;
+    a->used = 0;
+}
+
+static LineRec *line_store_append(LineStore *ls) {
+    if (!ls->chunks) {
+        ls->chunks = (LineRec**)calloc(LINE_CHUNK_MAX, sizeof(LineRec*));
+        if (!ls->chunks) return NULL;
+    }
+
+    int chunk = ls->count >> LINE_CHUNK_SHIFT;
+    if (chunk >= ls->chunk_count) {
+        if (chunk >= LINE_CHUNK_MAX) return NULL;
+
+        ls->chunks[chunk] = (LineRec*)malloc(LINE_CHUNK_SIZE * sizeof(LineRec));
+        if (!ls->chunks[chunk]) return NULL;
+        ls->chunk_count = chunk + 1;
+    }
+
+    return &ls->chunks[chunk][ls->count++ & LINE_CHUNK_MASK];
+}
+
+// Copies one line into the arena. The ANSI-stripped view is written right
+// after the raw bytes only when the line actually contains an escape.
+static int line_store_add(LineStore *ls, const char *s, size_t len) {
+    // Everything downstream treats lines as C strings; cut at an embedded NUL
+    // so plain_len always agrees with strlen, as fgets-based reading did.
+    const char *nul = (const char*)memchr(s, '\0', len);
+    if (nul) len = (size_t)(nul - s);
+    if (len >= ARENA_LINE_MAX) return 0;
+
+    int has_esc = memchr(s, '\033', len) != NULL;
+    uint32_t need = (uint32_t)len + 1;
+    if (has_esc) need *= 2;
+
+    char *dst = arena_reserve(&ls->arena, need);
+    if (!dst) return 0;
+
+    uint32_t slab = (uint32_t)ls->arena.cur;
+    uint32_t off = ls->arena.used;
+
+    LineRec *rec = line_store_append(ls);
+    if (!rec) return 0;
+
+    memcpy(dst, s, len);
+    dst[len] = '\0';
+
+    uint32_t plain_len = (uint32_t)len;
+    const char *plain = dst;
+    if (has_esc) {
+        plain = dst + len + 1;
+        plain_len = (uint32_t)strip_ansi(dst, dst + len + 1, len + 1);
+        arena_commit(&ls->arena, (uint32_t)len + 1 + plain_len + 1);
+    } else {
+        arena_commit(&ls->arena, (uint32_t)len + 1);
+    }
+
+    rec->slab = (uint16_t)slab;
+    rec->flags = 0;
+    rec->off = off;
+    rec->raw_len = (uint32_t)len;
+    rec->plain_len = plain_len;
+    rec->sig = char_signature(plain, plain_len);
+    return 1;
+}
+
+static void line_store_clear(LineStore *ls) {
+    ls->count = 0;
+    arena_reset(&ls->arena);
+}
+
+static void line_store_free(LineStore *ls) {
+    for (int c = 0; c < ls->chunk_count; c++) free(ls->chunks[c]);
+    free(ls->chunks);
+    for (int i = 0; i < ls->arena.slab_count; i++) free(ls->arena.slabs[i]);
+    free(ls->arena.slabs);
+    free(ls->arena.slab_sizes);
+    memset(ls, 0, sizeof(*ls));
+}
+
+// Bytes held by a store: its line records plus every arena slab.
+static uint64_t line_store_bytes(const LineStore *ls) {
+    uint64_t bytes = (uint64_t)ls->chunk_count * LINE_CHUNK_SIZE * sizeof(LineRec);
+    for (int i = 0; i < ls->arena.slab_count; i++) bytes += ls->arena.slab_sizes[i];
+    return bytes;
+}
+
+// Reloads build into the spare store so a failed reload can put the old lines
+// back. Either way the loser is reset in O(1) and kept for the next reload.
+static void line_store_begin_reload(FuzzyState *st, int *old_line_count) {
+    matcher_stop(st);
+    st->store_gen++;
+
+    LineStore tmp = st->store;
+    st->store = st->spare_store;
+    st->spare_store = tmp;
+    line_store_clear(&st->store);
+
+    *old_line_count = st->line_count;
+    st->line_count = 0;
+}
+
+static void line_store_end_reload(FuzzyState *st, int keep_new, int old_line_count) {
+    if (!keep_new) {
+        st->store_gen++;
+
+        LineStore tmp = st->store;
+        st->store = st->spare_store;
+        st->spare_store = tmp;
+        st->line_count = old_line_count;
+    }
+    line_store_clear(&st->spare_store);
+}
+
+// scores, match_indices and reject_indices are indexed by line and grow with the
+// store; capacity never shrinks so a restored snapshot always fits.
+static int ensure_line_capacity(FuzzyState *st, int needed) {
+    if (needed <= st->line_cap) return 1;
+
+    int cap = st->line_cap ? st->line_cap : 4096;
+    while (cap < needed) {
+        if (cap > INT_MAX / 2) { cap = needed; break; }
+        cap *= 2;
+    }
+
+    int *scores = (int*)realloc(st->scores, (size_t)cap * sizeof(int));
+    if (!scores) return 0;
+    st->scores = scores;
+
+    int *indices = (int*)realloc(st->match_indices, (size_t)cap * sizeof(int));
+    if (!indices) return 0;
+    st->match_indices = indices;
+
+    int *rejects = (int*)realloc(st->reject_indices, (size_t)cap * sizeof(int));
+    if (!rejects) return 0;
+    st->reject_indices = rejects;
+
+    st->line_cap = cap;
+    return 1;
+}
+
 static char *slurp_first_line(FILE *fp) {
     if (!fp) return NULL;
     char buf[PATH_MAX];
@@ -118,12 +848,22 @@ static char *slurp_first_line(FILE *fp) {
     return strdup(buf);
 }
 
-static char *ssh_get_home(const char *user, const char *host) {
+static char *ssh_get_home(FuzzyState *st, const char *user, const char *host) {
+    char target[520];
+    ssh_target(user, host, target, sizeof(target));
+    if (st->ssh.home && strcmp(st->ssh.home_target, target) == 0) {
+        return strdup(st->ssh.home);
+    }
+
     // Print $HOME reliably (no quotes needed on the var)
-    FILE *fp = ssh_popen(user, host, "printf '%s\n' \"$HOME\"");
+    FILE *fp = ssh_popen(st, user, host, "printf '%s\n' \"$HOME\"");
     if (!fp) return NULL;
     char *line = slurp_first_line(fp);
-    pclose(fp);
+    if (pclose(fp) == 0 && line) {
+        free(st->ssh.home);
+        st->ssh.home = strdup(line);
+        snprintf(st->ssh.home_target, sizeof(st->ssh.home_target), "%s", target);
+    }
     return line; // malloc'd
 }
 
@@ -137,7 +877,7 @@ static void resolve_remote_tilde_inplace(FuzzyState *st) {
     // We intentionally do NOT support ~user or ~user/... (could add later).
     if (p[1] != '\0' && p[1] != '/') return;
 
-    char *home = ssh_get_home(st->ssh_user, st->ssh_host);
+    char *home = ssh_get_home(st, st->ssh_user, st->ssh_host);
     if (!home || !home[0]) {
         free(home);
         return;
@@ -214,6 +954,63 @@ static long now_ms(void) {
 #endif
 }
 
+static long now_us(void) {
+#if defined(CLOCK_MONOTONIC)
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long)(ts.tv_sec * 1000000L + ts.tv_nsec / 1000L);
+#else
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return (long)(tv.tv_sec * 1000000L + tv.tv_usec);
+#endif
+}
+
+static void latency_record(LatencyLog *log, long us) {
+    if (log->count == log->cap) {
+        int cap = log->cap ? log->cap * 2 : 256;
+        uint32_t *samples = (uint32_t*)realloc(log->us, (size_t)cap * sizeof(uint32_t));
+        if (!samples) return;
+        log->us = samples;
+        log->cap = cap;
+    }
+    log->us[log->count++] = us < 0 ? 0 : (uint32_t)(us > (long)UINT32_MAX ? UINT32_MAX : us);
+}
+
+static int compare_u32(const void *a, const void *b) {
+    uint32_t x = *(const uint32_t*)a, y = *(const uint32_t*)b;
+    return (x > y) - (x < y);
+}
+
+// Nearest-rank percentile; sorts the log in place.
+static double latency_percentile_ms(LatencyLog *log, int pct) {
+    if (log->count == 0) return 0.0;
+    qsort(log->us, (size_t)log->count, sizeof(uint32_t), compare_u32);
+    int rank = (pct * log->count + 99) / 100;
+    if (rank < 1) rank = 1;
+    return log->us[rank - 1] / 1000.0;
+}
+
+static void format_count(char *buf, size_t size, uint64_t n) {
+    if (n >= 1000000000ULL) snprintf(buf, size, "%.1fG", (double)n / 1e9);
+    else if (n >= 1000000ULL) snprintf(buf, size, "%.1fM", (double)n / 1e6);
+    else if (n >= 10000ULL) snprintf(buf, size, "%.1fk", (double)n / 1e3);
+    else snprintf(buf, size, "%llu", (unsigned long long)n);
+}
+
+static void format_bytes(char *buf, size_t size, uint64_t n) {
+    if (n >= (1ULL << 30)) snprintf(buf, size, "%.1f GB", (double)n / (double)(1ULL << 30));
+    else if (n >= (1ULL << 20)) snprintf(buf, size, "%.1f MB", (double)n / (double)(1ULL << 20));
+    else if (n >= (1ULL << 10)) snprintf(buf, size, "%.1f KB", (double)n / (double)(1ULL << 10));
+    else snprintf(buf, size, "%llu B", (unsigned long long)n);
+}
+
+static void format_duration(char *buf, size_t size, long ms) {
+    if (ms >= 60000) snprintf(buf, size, "%ldm%02lds", ms / 60000, ms / 1000 % 60);
+    else if (ms >= 1000) snprintf(buf, size, "%.1fs", (double)ms / 1000.0);
+    else snprintf(buf, size, "%ldms", ms);
+}
+
 static void usage(const char *prog) {
     fprintf(stderr,
         "Usage:\n"
@@ -222,9 +1019,20 @@ static void usage(const char *prog) {
         "  %s [OPTIONS] file1 [file2 ...]\n"
         "  %s [OPTIONS] -D [directory]\n"
         "  %s [OPTIONS] -D [user@]host:directory\n"
+        "  %s [OPTIONS] -R [directory]\n"
         "  %s [OPTIONS] -G file1 [file2 ...]\n"
         "  --live CMD          Live mode: rerun CMD periodically and refresh results\n"
-        "  --interval MS       Live refresh interval in milliseconds (default 1000)\n"
+        "  --interval MS       Live refresh interval in milliseconds (default 1000;\n"
+        "                      stretches while output is unchanged or slow to produce)\n"
+        "  --threads N         Scoring threads (default: one per online CPU)\n"
+        "  --algo=v1|v2        Fuzzy scorer: greedy (v1, default) or optimal alignment (v2)\n"
+        "  --filter QUERY      Print lines matching QUERY, best first, without the UI\n"
+        "  --limit N           With --filter, print at most N lines\n"
+        "  --count             Print only the number of matching lines (implies --filter)\n"
+        "  --stats             Print latency percentiles to stderr on exit\n"
+        "  --depth N           With -R, descend at most N levels\n"
+        "  --exclude GLOB      With -R, skip files and directories whose name matches\n"
+        "  --hidden            Include hidden files (-R) / start showing them (-D)\n"
         "\n"
         "Options:\n"
         "  -h, --help          Show this help\n"
@@ -234,7 +1042,9 @@ static void usage(const char *prog) {
         "  -r                  Start in regex match mode\n"
         "  -d DELIM            Use delimiter for multi-column display\n"
         "  -D [DIR]            Directory browsing mode (local or remote)\n"
-        "  -G                  Grep mode - show filename:line_number:content\n"
+        "  -R [DIR]            Every file under DIR, recursively (default: .)\n"
+        "  -G                  Grep mode - search the files' contents as you type,\n"
+        "                      showing filename:line_number:content\n"
         "\n"
         "Keybindings:\n"
         "  i                   Enter INSERT mode (type to filter)\n"
@@ -243,7 +1053,7 @@ static void usage(const char *prog) {
         "  Ctrl+D/Ctrl+U       Half-page down/up\n"
         "  g/G                 Jump to top/bottom\n"
         "  h                   Go to parent directory (directory mode)\n"
-        "  .                   Toggle hidden files (directory mode, works when filter empty)\n"
+        "  .                   Toggle hidden files (-D/-R, works when filter empty)\n"
         "  Enter               Select file / Navigate into directory\n"
         "  Ctrl+C, q           Exit without selection (NORMAL mode)\n"
         "  Backspace           Delete character (INSERT mode)\n"
@@ -253,9 +1063,10 @@ static void usage(const char *prog) {
         "  Ctrl+E              Toggle EXACT match mode\n"
         "  Ctrl+F              Toggle FUZZY match mode\n"
         "  Ctrl+X              Toggle REGEX match mode\n"
+        "  Ctrl+T              Toggle performance overlay\n"
         "\n"
         "Reads lines from stdin (pipe) OR from file arguments OR browse directory.\n",
-        prog, prog, prog, prog, prog, prog
+        prog, prog, prog, prog, prog, prog, prog
     );
 }
 
@@ -321,40 +1132,6 @@ static int strip_ansi(const char *in, char *out, size_t out_cap)
     return (int)j;
 }
 
-static int has_ansi_escape(const char *s) {
-    if (!s) return 0;
-    return strchr(s, '\033') != NULL;
-}
-
-static void build_matched_mask(const char *plain, const char *query, int case_sensitive,
-                               int *out_mask, int mask_cap) {
-    if (!out_mask || mask_cap <= 0) return;
-    memset(out_mask, 0, (size_t)mask_cap * sizeof(int));
-
-    if (!plain || !*plain) return;
-    if (!query || !*query) return;
-
-    int q_len = (int)strlen(query);
-    int l_len = (int)strlen(plain);
-    if (l_len > mask_cap) l_len = mask_cap;
-
-    int q_idx = 0;
-    for (int l_idx = 0; l_idx < l_len && q_idx < q_len; l_idx++) {
-        char q_ch = query[q_idx];
-        char l_ch = plain[l_idx];
-
-        if (!case_sensitive) {
-            if (q_ch >= 'A' && q_ch <= 'Z') q_ch = (char)(q_ch - 'A' + 'a');
-            if (l_ch >= 'A' && l_ch <= 'Z') l_ch = (char)(l_ch - 'A' + 'a');
-        }
-
-        if (q_ch == l_ch) {
-            out_mask[l_idx] = 1;
-            q_idx++;
-        }
-    }
-}
-
 typedef struct {
     int bold;
     int underline;
@@ -363,7 +1140,7 @@ typedef struct {
     int bright;  // 0/1
 } AnsiStyle;
 
-static void ansi_apply_style(const AnsiStyle *s, attr_t base_attr, short base_pair) {
+static attr_t ansi_style_attr(const AnsiStyle *s, attr_t base_attr, short base_pair) {
     attr_t a = base_attr;
     short pair = base_pair;
 
@@ -377,7 +1154,7 @@ static void ansi_apply_style(const AnsiStyle *s, attr_t base_attr, short base_pa
         }
     }
 
-    attrset(a | COLOR_PAIR(pair));
+    return a | COLOR_PAIR(pair);
 }
 
 static void xterm256_to_rgb(int n, int *r, int *g, int *b) {
@@ -460,13 +1237,14 @@ static void rgb_to_ansi16(int r, int g, int b, int *fg, int *bright) {
 }
 
 static void render_ansi_line_with_matches(const char *raw,
-                                         const int *matched_mask, int matched_len,
+                                         const MatchSpan *spans, int span_count,
                                          int y, int x_start, int max_x,
                                          attr_t base_attr, short base_pair) {
     if (!raw) return;
 
     int x = x_start;
     int plain_pos = 0;
+    int span = 0;
 
     AnsiStyle st;
     st.bold = 0;
@@ -475,7 +1253,14 @@ static void render_ansi_line_with_matches(const char *raw,
     st.fg = -1;
     st.bright = 0;
 
-    ansi_apply_style(&st, base_attr, base_pair);
+    attr_t style = ansi_style_attr(&st, base_attr, base_pair);
+
+    // Visible bytes are collected into runs of one attribute and written
+    // with a single addnstr per run.
+    char run[256];
+    int run_len = 0;
+    int run_x = x;
+    attr_t run_attr = style;
 
     for (int i = 0; raw[i] && x < max_x; ) {
         unsigned char c = (unsigned char)raw[i];
@@ -567,7 +1352,7 @@ static void render_ansi_line_with_matches(const char *raw,
                         // background could be 48;... but we ignore it (ncurses bg mapping is messy)
                     }
 
-                    ansi_apply_style(&st, base_attr, base_pair);
+                    style = ansi_style_attr(&st, base_attr, base_pair);
                 }
 
                 continue;
@@ -580,191 +1365,450 @@ static void render_ansi_line_with_matches(const char *raw,
 
         if (c == '\t') c = ' ';
 
-        int is_match = 0;
-        if (matched_mask && plain_pos >= 0 && plain_pos < matched_len && matched_mask[plain_pos]) {
-            is_match = 1;
-        }
+        while (span < span_count && (uint32_t)plain_pos >= spans[span].start + spans[span].len) span++;
+        int is_match = span < span_count && (uint32_t)plain_pos >= spans[span].start;
 
-        if (is_match) attron(A_REVERSE | A_BOLD);
-        mvaddch(y, x++, (chtype)c);
-        if (is_match) {
-            attroff(A_REVERSE | A_BOLD);
-            ansi_apply_style(&st, base_attr, base_pair);
+        attr_t a = is_match ? (style | A_REVERSE | A_BOLD) : style;
+        if (run_len > 0 && (a != run_attr || run_len == (int)sizeof(run))) {
+            attrset(run_attr);
+            mvaddnstr(y, run_x, run, run_len);
+            run_len = 0;
+        }
+        if (run_len == 0) {
+            run_x = x;
+            run_attr = a;
         }
+        run[run_len++] = (char)c;
+        x++;
 
         plain_pos++;
         i++;
     }
 
+    if (run_len > 0) {
+        attrset(run_attr);
+        mvaddnstr(y, run_x, run, run_len);
+    }
+
     attrset(base_attr | COLOR_PAIR(base_pair));
 }
 
-static void refresh_live_command(FuzzyState *st) {
-    if (!st->live_mode || !st->live_cmd || !st->live_cmd[0]) return;
+// Character-presence signature: a-z (case-folded) and 0-9 get a bit each, the
+// remaining bytes share 28 bits. A line can only contain the query if every
+// bit of the query's signature is also set in the line's.
+static inline uint64_t char_sig_bit(unsigned char c) {
+    if (c >= 'A' && c <= 'Z') c = (unsigned char)(c - 'A' + 'a');
+    if (c >= 'a' && c <= 'z') return 1ULL << (c - 'a');
+    if (c >= '0' && c <= '9') return 1ULL << (26 + (c - '0'));
+    return 1ULL << (36 + c % 28);
+}
 
-    char want[MAX_LINE_LEN];
-    want[0] = '\0';
-    if (st->match_count > 0 && st->selected >= 0 && st->selected < st->match_count) {
-        int old_idx = st->match_indices[st->selected];
-        const char *s = st->lines[old_idx];
-        if (s) {
-            strncpy(want, s, sizeof(want) - 1);
-            want[sizeof(want) - 1] = '\0';
-        }
-    }
+static uint64_t char_signature(const char *s, size_t len) {
+    uint64_t sig = 0;
+    for (size_t i = 0; i < len; i++) sig |= char_sig_bit((unsigned char)s[i]);
+    return sig;
+}
 
-    int old_line_count = st->line_count;
-    char **old_lines = NULL;
-    char **old_raw_lines = NULL;
+// Finds the first byte in [p, end) equal to c. With fold set, c must be a
+// lowercase letter and uppercase bytes match too: OR-ing 0x20 maps exactly
+// 'A'..'Z' onto 'a'..'z' among the bytes that can then compare equal to c.
+typedef const char *(*FindByteFn)(const char *p, const char *end, unsigned char c, int fold);
 
-    if (old_line_count > 0) {
-        old_lines = (char**)calloc((size_t)old_line_count, sizeof(char*));
-        old_raw_lines = (char**)calloc((size_t)old_line_count, sizeof(char*));
-        if (old_lines && old_raw_lines) {
-            for (int i = 0; i < old_line_count; i++) {
-                old_lines[i] = st->lines[i];
-                old_raw_lines[i] = st->raw_lines[i];
-            }
-        } else {
-            free(old_lines);
-            free(old_raw_lines);
-            old_lines = NULL;
-            old_raw_lines = NULL;
-        }
+static const char *find_byte_scalar(const char *p, const char *end, unsigned char c, int fold) {
+    unsigned char mask = fold ? 0x20 : 0;
+    for (; p < end; p++) {
+        if (((unsigned char)*p | mask) == c) return p;
     }
+    return NULL;
+}
 
-    st->line_count = 0;
-
-    FILE *fp = popen(st->live_cmd, "r");
-    if (!fp) {
-        if (old_lines && old_raw_lines) {
-            for (int i = 0; i < old_line_count; i++) {
-                st->lines[i] = old_lines[i];
-                st->raw_lines[i] = old_raw_lines[i];
-            }
-            st->line_count = old_line_count;
-            free(old_lines);
-            free(old_raw_lines);
-        }
-        return;
+#ifdef FF_HAVE_X86_SIMD
+__attribute__((target("sse2")))
+static const char *find_byte_sse2(const char *p, const char *end, unsigned char c, int fold) {
+    __m128i needle = _mm_set1_epi8((char)c);
+    __m128i mask = _mm_set1_epi8((char)(fold ? 0x20 : 0));
+
+    while (end - p >= 16) {
+        __m128i v = _mm_loadu_si128((const __m128i*)p);
+        unsigned bits = (unsigned)_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_or_si128(v, mask), needle));
+        if (bits) return p + __builtin_ctz(bits);
+        p += 16;
     }
+    return find_byte_scalar(p, end, c, fold);
+}
 
-    load_stream(st, fp);
-    pclose(fp);
-
-    int success = (st->line_count > 0);
-
-    if (!success) {
-        for (int i = 0; i < st->line_count; i++) {
-            free(st->lines[i]);
-            free(st->raw_lines[i]);
-            st->lines[i] = NULL;
-            st->raw_lines[i] = NULL;
-        }
-        st->line_count = 0;
-
-        if (old_lines && old_raw_lines) {
-            for (int i = 0; i < old_line_count; i++) {
-                st->lines[i] = old_lines[i];
-                st->raw_lines[i] = old_raw_lines[i];
-            }
-            st->line_count = old_line_count;
-            free(old_lines);
-            free(old_raw_lines);
-        }
-        return;
-    }
+__attribute__((target("avx2")))
+static const char *find_byte_avx2(const char *p, const char *end, unsigned char c, int fold) {
+    __m256i needle = _mm256_set1_epi8((char)c);
+    __m256i mask = _mm256_set1_epi8((char)(fold ? 0x20 : 0));
 
-    if (old_lines && old_raw_lines) {
-        for (int i = 0; i < old_line_count; i++) {
-            free(old_lines[i]);
-            free(old_raw_lines[i]);
-        }
-        free(old_lines);
-        free(old_raw_lines);
+    while (end - p >= 32) {
+        __m256i v = _mm256_loadu_si256((const __m256i*)p);
+        unsigned bits = (unsigned)_mm256_movemask_epi8(_mm256_cmpeq_epi8(_mm256_or_si256(v, mask), needle));
+        if (bits) return p + __builtin_ctz(bits);
+        p += 32;
     }
+    return find_byte_sse2(p, end, c, fold);
+}
+#endif
 
-    update_matches(st);
-
-    if (want[0] != '\0' && st->match_count > 0) {
-        for (int m = 0; m < st->match_count; m++) {
-            int idx = st->match_indices[m];
-            if (st->lines[idx] && strcmp(st->lines[idx], want) == 0) {
-                st->selected = m;
-                ensure_visible(st);
-                return;
-            }
-        }
-    }
+static FindByteFn find_byte = find_byte_scalar;
 
-    st->selected = 0;
-    st->scroll_offset = 0;
-    clear();
+// Picks the widest scan the CPU supports. Must run before any scoring thread.
+static void simd_init(void) {
+#ifdef FF_HAVE_X86_SIMD
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) find_byte = find_byte_avx2;
+    else if (__builtin_cpu_supports("sse2")) find_byte = find_byte_sse2;
+#endif
 }
 
-static int fuzzy_score(const char *needle, const char *haystack, int case_sensitive) {
-    if (!needle || !*needle) return 1000;
+static inline unsigned char fold_needle(unsigned char c, int case_sensitive, int *fold) {
+    *fold = 0;
+    if (case_sensitive) return c;
+    if (c >= 'A' && c <= 'Z') c = (unsigned char)(c - 'A' + 'a');
+    if (c >= 'a' && c <= 'z') *fold = 1;
+    return c;
+}
 
-    int n_len = (int)strlen(needle);
-    int h_len = (int)strlen(haystack);
-    if (n_len > h_len) return -1;
+// Greedy leftmost subsequence match. Each needle character jumps straight to
+// its next occurrence with find_byte; skipping any bytes resets the run of
+// consecutive matches, exactly as the byte-at-a-time walk did. When pos is
+// given it receives the offset matched by each needle character.
+static int fuzzy_score(const char *needle, int n_len, const char *haystack, int h_len,
+                       int case_sensitive, int *pos_out) {
+    if (n_len == 0) return 1000;
+    if (n_len > h_len) return SCORE_NONE;
 
+    const char *end = haystack + h_len;
     int score = 0;
     int consecutive = 0;
     int h_idx = 0;
 
     for (int n_idx = 0; n_idx < n_len; n_idx++) {
-        char n_ch = needle[n_idx];
-        if (!case_sensitive && n_ch >= 'A' && n_ch <= 'Z') n_ch = (char)(n_ch - 'A' + 'a');
-
-        int found = 0;
-        for (; h_idx < h_len; h_idx++) {
-            char h_ch = haystack[h_idx];
-            if (!case_sensitive && h_ch >= 'A' && h_ch <= 'Z') h_ch = (char)(h_ch - 'A' + 'a');
-
-            if (n_ch == h_ch) {
-                found = 1;
-                score += 1;
-
-                if (n_idx > 0 && h_idx > 0 && consecutive > 0) {
-                    int bonus = 5 * consecutive;
-                    if (score > INT_MAX - bonus) score = INT_MAX;
-                    else score += bonus;
-                }
-                consecutive++;
-
-                if (h_idx == 0 ||
-                    haystack[h_idx - 1] == ' ' ||
-                    haystack[h_idx - 1] == '/' ||
-                    haystack[h_idx - 1] == '_') {
-                    if (score <= INT_MAX - 10) score += 10;
-                    else score = INT_MAX;
-                }
+        int fold;
+        unsigned char n_ch = fold_needle((unsigned char)needle[n_idx], case_sensitive, &fold);
 
-                h_idx++;
-                break;
-            } else {
-                consecutive = 0;
-            }
+        const char *hit = find_byte(haystack + h_idx, end, n_ch, fold);
+        if (!hit) return SCORE_NONE;
+
+        int pos = (int)(hit - haystack);
+        if (pos > h_idx) consecutive = 0;
+        if (pos_out) pos_out[n_idx] = pos;
+
+        score += 1;
+
+        if (n_idx > 0 && pos > 0 && consecutive > 0) {
+            int bonus = 5 * consecutive;
+            if (score > INT_MAX - bonus) score = INT_MAX;
+            else score += bonus;
+        }
+        consecutive++;
+
+        if (pos == 0 ||
+            haystack[pos - 1] == ' ' ||
+            haystack[pos - 1] == '/' ||
+            haystack[pos - 1] == '_') {
+            if (score <= INT_MAX - 10) score += 10;
+            else score = INT_MAX;
         }
 
-        if (!found) return -1;
+        h_idx = pos + 1;
     }
 
     score -= (h_len - n_len);
     return score;
 }
 
-static int regex_score(const char *pattern, const char *haystack, int case_sensitive,
-                       regex_t *regex, int *regex_valid, char *regex_error, size_t error_size) {
-    if (!pattern || !*pattern) {
-        *regex_valid = 0;
-        return 1000;
+// Scoring constants for the v2 alignment. A gap costs ALIGN_GAP_START for its
+// first skipped byte and ALIGN_GAP_EXTEND for each further one; characters
+// that start a word earn a bonus, doubled for the query's first character.
+#define ALIGN_MATCH             16
+#define ALIGN_GAP_START         (-3)
+#define ALIGN_GAP_EXTEND        (-1)
+#define ALIGN_BONUS_BOUNDARY    8
+#define ALIGN_BONUS_WHITE       10
+#define ALIGN_BONUS_DELIM       9
+#define ALIGN_BONUS_CAMEL       7
+#define ALIGN_BONUS_CONSECUTIVE 4
+#define ALIGN_FIRST_MULT        2
+#define ALIGN_NEG               (INT_MIN / 2)
+
+enum { CC_WHITE, CC_DELIM, CC_NONWORD, CC_LOWER, CC_UPPER, CC_DIGIT };
+
+static inline int char_class(unsigned char c) {
+    if (c >= 'a' && c <= 'z') return CC_LOWER;
+    if (c >= 'A' && c <= 'Z') return CC_UPPER;
+    if (c >= '0' && c <= '9') return CC_DIGIT;
+    if (c == ' ' || c == '\t') return CC_WHITE;
+    if (c == '/' || c == ',' || c == ':' || c == ';' || c == '|') return CC_DELIM;
+    if (c >= 0x80) return CC_LOWER;
+    return CC_NONWORD;
+}
+
+// Bonus for matching a character of class cur that follows one of class prev.
+static inline int boundary_bonus(int prev, int cur) {
+    if (cur >= CC_LOWER) {
+        if (prev == CC_WHITE) return ALIGN_BONUS_WHITE;
+        if (prev == CC_DELIM) return ALIGN_BONUS_DELIM;
+        if (prev == CC_NONWORD) return ALIGN_BONUS_BOUNDARY;
+        if (prev == CC_LOWER && cur == CC_UPPER) return ALIGN_BONUS_CAMEL;
+        if (prev != CC_DIGIT && cur == CC_DIGIT) return ALIGN_BONUS_CAMEL;
+        return 0;
     }
+    return cur == CC_WHITE ? ALIGN_BONUS_WHITE : ALIGN_BONUS_BOUNDARY;
+}
 
-    if (!*regex_valid) {
-        int flags = REG_EXTENDED | REG_NOSUB;
-        if (!case_sensitive) flags |= REG_ICASE;
+static inline int bonus_at(const char *h, int pos) {
+    int prev = pos > 0 ? char_class((unsigned char)h[pos - 1]) : CC_WHITE;
+    return boundary_bonus(prev, char_class((unsigned char)h[pos]));
+}
+
+static inline unsigned char fold_ascii(unsigned char c, int case_sensitive) {
+    if (!case_sensitive && c >= 'A' && c <= 'Z') return (unsigned char)(c - 'A' + 'a');
+    return c;
+}
+
+// Scores the leftmost alignment that ends where the greedy walk ends and
+// starts as late as possible, with the same weights the DP uses. This is
+// the bounded-cost path for windows too large to align exactly.
+static int align_score_greedy(const char *needle, int n_len, const char *h, int end,
+                              int case_sensitive, int *pos_out) {
+    int start = end;
+    for (int i = n_len - 1; i >= 0; start--) {
+        if (fold_ascii((unsigned char)h[start], case_sensitive) ==
+            fold_ascii((unsigned char)needle[i], case_sensitive)) {
+            if (--i < 0) break;
+        }
+    }
+
+    int score = 0, run = 0, run_bonus = 0, in_gap = 0, n_idx = 0;
+    for (int pos = start; pos <= end && n_idx < n_len; pos++) {
+        if (fold_ascii((unsigned char)h[pos], case_sensitive) !=
+            fold_ascii((unsigned char)needle[n_idx], case_sensitive)) {
+            score += in_gap ? ALIGN_GAP_EXTEND : ALIGN_GAP_START;
+            in_gap = 1;
+            run = 0;
+            continue;
+        }
+
+        int b = bonus_at(h, pos);
+        if (run == 0) run_bonus = b;
+        else {
+            if (b >= ALIGN_BONUS_BOUNDARY && b > run_bonus) run_bonus = b;
+            if (run_bonus > b) b = run_bonus;
+            if (b < ALIGN_BONUS_CONSECUTIVE) b = ALIGN_BONUS_CONSECUTIVE;
+        }
+
+        score += ALIGN_MATCH + (n_idx == 0 ? b * ALIGN_FIRST_MULT : b);
+        if (pos_out) pos_out[n_idx] = pos;
+        in_gap = 0;
+        run++;
+        n_idx++;
+    }
+    return score;
+}
+
+static int align_reserve(AlignScratch *sc, int cells) {
+    if (cells <= sc->cap) return 1;
+
+    int cap = sc->cap ? sc->cap : 1024;
+    while (cap < cells) cap *= 2;
+
+    int *score = (int*)realloc(sc->score, (size_t)cap * sizeof(int));
+    if (!score) return 0;
+    sc->score = score;
+
+    int *run_bonus = (int*)realloc(sc->run_bonus, (size_t)cap * sizeof(int));
+    if (!run_bonus) return 0;
+    sc->run_bonus = run_bonus;
+
+    signed char *bonus = (signed char*)realloc(sc->bonus, (size_t)cap);
+    if (!bonus) return 0;
+    sc->bonus = bonus;
+
+    sc->cap = cap;
+    return 1;
+}
+
+static void align_free(AlignScratch *sc) {
+    free(sc->score);
+    free(sc->run_bonus);
+    free(sc->bonus);
+    memset(sc, 0, sizeof(*sc));
+}
+
+// Optimal-alignment fuzzy score: the best total over all ways of placing the
+// query as a subsequence, rewarding word boundaries and consecutive runs and
+// charging for gaps (Smith-Waterman with affine gaps, no leading or trailing
+// penalty). Lines without the subsequence get SCORE_NONE. Gaps can outweigh
+// the matches, so a widely scattered alignment scores below 0 and, like in
+// v1, counts as a near miss rather than a match. With pos_out the winning
+// alignment is traced back through the DP matrices.
+static int fuzzy_score_v2(const char *needle, int n_len, const char *h, int h_len,
+                          int case_sensitive, AlignScratch *sc, int *pos_out) {
+    if (n_len == 0) return 1000;
+    if (n_len > h_len) return SCORE_NONE;
+
+    unsigned char q[256];
+    for (int i = 0; i < n_len; i++) q[i] = fold_ascii((unsigned char)needle[i], case_sensitive);
+
+    // Greedy pass: proves the query is present and bounds the window.
+    const char *end = h + h_len;
+    int first = -1, greedy_end = 0;
+    for (int i = 0, pos = 0; i < n_len; i++) {
+        int fold;
+        unsigned char c = fold_needle(q[i], case_sensitive, &fold);
+        const char *hit = find_byte(h + pos, end, c, fold);
+        if (!hit) return SCORE_NONE;
+        pos = (int)(hit - h);
+        if (i == 0) first = pos;
+        greedy_end = pos;
+        pos++;
+    }
+
+    int last = h_len - 1;
+    while (fold_ascii((unsigned char)h[last], case_sensitive) != q[n_len - 1]) last--;
+
+    int width = last - first + 1;
+    if ((long)width * n_len > ALIGN_MAX_CELLS || !align_reserve(sc, width * n_len)) {
+        return align_score_greedy(needle, n_len, h, greedy_end, case_sensitive, pos_out);
+    }
+
+    const char *win = h + first;
+    for (int j = 0; j < width; j++) sc->bonus[j] = (signed char)bonus_at(h, first + j);
+
+    int *row = sc->score;
+    int *run = sc->run_bonus;
+    for (int j = 0; j < width; j++) {
+        if (fold_ascii((unsigned char)win[j], case_sensitive) == q[0]) {
+            row[j] = ALIGN_MATCH + sc->bonus[j] * ALIGN_FIRST_MULT;
+            run[j] = sc->bonus[j];
+        } else {
+            row[j] = ALIGN_NEG;
+            run[j] = 0;
+        }
+    }
+
+    for (int i = 1; i < n_len; i++) {
+        const int *prev = row;
+        const int *prev_run = run;
+        row += width;
+        run += width;
+
+        // gap: best score of row i-1 ending at least two columns back, with
+        // the bytes in between charged as one gap.
+        int gap = ALIGN_NEG;
+        for (int j = 0; j < width; j++) {
+            if (j >= 2) {
+                int open = prev[j - 2] + ALIGN_GAP_START;
+                gap += ALIGN_GAP_EXTEND;
+                if (open > gap) gap = open;
+            }
+
+            row[j] = ALIGN_NEG;
+            run[j] = 0;
+            if (j < i || fold_ascii((unsigned char)win[j], case_sensitive) != q[i]) continue;
+
+            int b = sc->bonus[j];
+            if (gap > ALIGN_NEG / 2) {
+                row[j] = gap + ALIGN_MATCH + b;
+                run[j] = b;
+            }
+
+            if (prev[j - 1] > ALIGN_NEG / 2) {
+                int rb = prev_run[j - 1];
+                if (b >= ALIGN_BONUS_BOUNDARY && b > rb) rb = b;
+                int cb = rb > b ? rb : b;
+                if (cb < ALIGN_BONUS_CONSECUTIVE) cb = ALIGN_BONUS_CONSECUTIVE;
+                int diag = prev[j - 1] + ALIGN_MATCH + cb;
+                if (diag >= row[j]) {
+                    row[j] = diag;
+                    run[j] = rb;
+                }
+            }
+        }
+    }
+
+    int best = ALIGN_NEG, best_j = 0;
+    for (int j = 0; j < width; j++) {
+        if (row[j] > best) {
+            best = row[j];
+            best_j = j;
+        }
+    }
+
+    if (pos_out) {
+        // Walk back up the rows, preferring the diagonal as the fill did.
+        int j = best_j;
+        for (int i = n_len - 1; i > 0; i--) {
+            const int *cur = sc->score + i * width;
+            const int *prev = cur - width;
+            const int *prev_run = sc->run_bonus + (i - 1) * width;
+            int b = sc->bonus[j];
+            pos_out[i] = first + j;
+
+            if (prev[j - 1] > ALIGN_NEG / 2) {
+                int rb = prev_run[j - 1];
+                if (b >= ALIGN_BONUS_BOUNDARY && b > rb) rb = b;
+                int cb = rb > b ? rb : b;
+                if (cb < ALIGN_BONUS_CONSECUTIVE) cb = ALIGN_BONUS_CONSECUTIVE;
+                if (prev[j - 1] + ALIGN_MATCH + cb == cur[j]) {
+                    j--;
+                    continue;
+                }
+            }
+
+            int want = cur[j] - ALIGN_MATCH - b - ALIGN_GAP_START;
+            int p = j - 2;
+            while (p > 0 && prev[p] != want) {
+                p--;
+                want -= ALIGN_GAP_EXTEND;
+            }
+            j = p;
+        }
+        pos_out[0] = first + j;
+    }
+
+    return best;
+}
+
+// Substring search for exact mode; returns the match offset or -1.
+static int exact_find(const char *needle, int n_len, const char *haystack, int h_len, int case_sensitive) {
+    if (n_len == 0) return 0;
+
+    int fold;
+    unsigned char first = fold_needle((unsigned char)needle[0], case_sensitive, &fold);
+    const char *end = haystack + h_len - n_len + 1;
+    const char *p = haystack;
+
+    while (p < end && (p = find_byte(p, end, first, fold)) != NULL) {
+        int k = 1;
+        for (; k < n_len; k++) {
+            unsigned char a = (unsigned char)p[k];
+            unsigned char b = (unsigned char)needle[k];
+            if (!case_sensitive) {
+                if (a >= 'A' && a <= 'Z') a = (unsigned char)(a - 'A' + 'a');
+                if (b >= 'A' && b <= 'Z') b = (unsigned char)(b - 'A' + 'a');
+            }
+            if (a != b) break;
+        }
+        if (k == n_len) return (int)(p - haystack);
+        p++;
+    }
+    return -1;
+}
+
+static int regex_score(const char *pattern, const char *haystack, int case_sensitive,
+                       regex_t *regex, int *regex_valid, char *regex_error, size_t error_size) {
+    if (!pattern || !*pattern) {
+        *regex_valid = 0;
+        return 1000;
+    }
+
+    if (!*regex_valid) {
+        int flags = REG_EXTENDED | REG_NOSUB;
+        if (!case_sensitive) flags |= REG_ICASE;
 
         int ret = regcomp(regex, pattern, flags);
         if (ret != 0) {
@@ -790,7 +1834,12 @@ static int compare_scores(const void *a, const void *b, void *state) {
     int diff = st->scores[idx_b] - st->scores[idx_a];
     if (diff != 0) return diff;
 
-    return (int)strlen(st->lines[idx_a]) - (int)strlen(st->lines[idx_b]);
+    diff = (int)store_rec(&st->store, idx_a)->plain_len - (int)store_rec(&st->store, idx_b)->plain_len;
+    if (diff != 0) return diff;
+
+    // Input order breaks remaining ties so the ranking does not depend on
+    // how the scan was split across threads.
+    return (idx_a > idx_b) - (idx_a < idx_b);
 }
 
 static FuzzyState *g_sort_ctx = NULL;
@@ -808,510 +1857,3031 @@ static int compare_scores_gnu(const void *a, const void *b, void *state) {
 }
 #endif
 
-static void update_matches(FuzzyState *st) {
-    st->match_count = 0;
+// -G hits read "file:line:content", and the query applies to the content
+// alone, as it did when the hit was found. Grep paths never contain ':'.
+static int grep_label_len(const FuzzyState *st, const char *line, int len) {
+    if (!st->grep_mode) return 0;
+    const char *c1 = (const char*)memchr(line, ':', (size_t)len);
+    if (!c1) return 0;
+    const char *c2 = (const char*)memchr(c1 + 1, ':', (size_t)(line + len - c1 - 1));
+    return c2 ? (int)(c2 + 1 - line) : 0;
+}
 
-    if (st->query_len == 0) {
-        for (int i = 0; i < st->line_count; i++) {
-            st->scores[i] = 1000;
-            st->match_indices[st->match_count++] = i;
+static int score_line(FuzzyState *st, int idx, AlignScratch *align) {
+    if (st->query_len == 0) return 1000;
+
+    const LineRec *rec = store_rec(&st->store, idx);
+    const char *line = line_plain(st, idx);
+    int len = (int)rec->plain_len;
+    int label = grep_label_len(st, line, len);
+    line += label;
+    len -= label;
+
+    switch (st->match_mode) {
+        case MATCH_EXACT:
+            if ((rec->sig & st->query_sig) != st->query_sig) return SCORE_NONE;
+            return exact_find(st->query, st->query_len, line, len,
+                              st->case_sensitive) >= 0 ? 1000 : SCORE_NONE;
+
+        case MATCH_REGEX:
+            return regex_score(st->query, line, st->case_sensitive,
+                               &st->regex, &st->regex_valid,
+                               st->regex_error, sizeof(st->regex_error));
+
+        case MATCH_FUZZY:
+        default:
+            if ((rec->sig & st->query_sig) != st->query_sig) return SCORE_NONE;
+            if (st->algo == ALGO_V2) {
+                return fuzzy_score_v2(st->query, st->query_len, line, len,
+                                      st->case_sensitive, align, NULL);
+            }
+            return fuzzy_score(st->query, st->query_len, line, len,
+                               st->case_sensitive, NULL);
+    }
+}
+
+static int span_push(SpanEntry *e, uint32_t start, uint32_t len) {
+    if (e->count > 0) {
+        MatchSpan *last = &e->spans[e->count - 1];
+        if (last->start + last->len == start) {
+            last->len += len;
+            return 1;
         }
-        st->selected = 0;
-        st->scroll_offset = 0;
-        return;
     }
 
-    for (int i = 0; i < st->line_count; i++) {
-        int score = -1;
+    if (e->count == e->cap) {
+        int cap = e->cap ? e->cap * 2 : 8;
+        MatchSpan *spans = (MatchSpan*)realloc(e->spans, (size_t)cap * sizeof(MatchSpan));
+        if (!spans) return 0;
+        e->spans = spans;
+        e->cap = cap;
+    }
+    e->spans[e->count].start = start;
+    e->spans[e->count].len = len;
+    e->count++;
+    return 1;
+}
 
-        switch (st->match_mode) {
-            case MATCH_EXACT: {
-                const char *found = st->case_sensitive ?
-                    strstr(st->lines[i], st->query) :
-                    strcasestr(st->lines[i], st->query);
-                score = found ? 1000 : -1;
-                break;
+// Reruns the engine of the current mode on one line, recording what it
+// matched: the aligned characters in fuzzy mode, the substring found in exact
+// mode and every non-overlapping match of the pattern in regex mode.
+static void compute_spans(FuzzyState *st, int idx, SpanEntry *e) {
+    e->count = 0;
+    if (st->query_len == 0) return;
+
+    const char *line = line_plain(st, idx);
+    int len = (int)store_rec(&st->store, idx)->plain_len;
+    int label = grep_label_len(st, line, len);
+    line += label;
+    len -= label;
+
+    switch (st->match_mode) {
+        case MATCH_EXACT: {
+            int off = exact_find(st->query, st->query_len, line, len, st->case_sensitive);
+            if (off >= 0) span_push(e, (uint32_t)off, (uint32_t)st->query_len);
+            break;
+        }
+
+        case MATCH_REGEX: {
+            if (st->span_regex_state == 0) {
+                int flags = REG_EXTENDED;
+                if (!st->case_sensitive) flags |= REG_ICASE;
+                st->span_regex_state = regcomp(&st->span_regex, st->query, flags) == 0 ? 1 : -1;
+            }
+            if (st->span_regex_state < 0) break;
+
+            int off = 0;
+            regmatch_t m;
+            while (off <= len &&
+                   regexec(&st->span_regex, line + off, 1, &m, off > 0 ? REG_NOTBOL : 0) == 0) {
+                if (m.rm_eo > m.rm_so) {
+                    if (!span_push(e, (uint32_t)(off + m.rm_so), (uint32_t)(m.rm_eo - m.rm_so))) break;
+                    off += (int)m.rm_eo;
+                } else {
+                    off += (int)m.rm_so + 1;
+                }
             }
+            break;
+        }
 
-            case MATCH_REGEX:
-                score = regex_score(st->query, st->lines[i], st->case_sensitive,
-                                    &st->regex, &st->regex_valid,
-                                    st->regex_error, sizeof(st->regex_error));
-                break;
+        case MATCH_FUZZY:
+        default: {
+            int pos[256];
+            int score = st->algo == ALGO_V2
+                ? fuzzy_score_v2(st->query, st->query_len, line, len, st->case_sensitive, &st->align, pos)
+                : fuzzy_score(st->query, st->query_len, line, len, st->case_sensitive, pos);
+            if (score == SCORE_NONE) break;
 
-            case MATCH_FUZZY:
-            default:
-                score = fuzzy_score(st->query, st->lines[i], st->case_sensitive);
-                break;
+            for (int i = 0; i < st->query_len; i++) {
+                if (!span_push(e, (uint32_t)pos[i], 1)) break;
+            }
+            break;
         }
+    }
+
+    for (int i = 0; i < e->count; i++) e->spans[i].start += (uint32_t)label;
+}
 
-        st->scores[i] = score;
-        if (score >= 0) st->match_indices[st->match_count++] = i;
+static const SpanEntry *line_spans(FuzzyState *st, int idx) {
+    SpanEntry *e = &st->span_cache[(unsigned)idx & (SPAN_CACHE_SLOTS - 1)];
+    if (e->line != idx || e->gen != st->span_gen) {
+        compute_spans(st, idx, e);
+        e->line = idx;
+        e->gen = st->span_gen;
     }
+    return e;
+}
+
+// Drops every cached span; called whenever the query, mode or lines change.
+static void span_cache_invalidate(FuzzyState *st) {
+    st->span_gen++;
+    if (st->span_regex_state > 0) regfree(&st->span_regex);
+    st->span_regex_state = 0;
+}
+
+static void span_cache_free(FuzzyState *st) {
+    for (int i = 0; i < SPAN_CACHE_SLOTS; i++) free(st->span_cache[i].spans);
+    memset(st->span_cache, 0, sizeof(st->span_cache));
+    if (st->span_regex_state > 0) regfree(&st->span_regex);
+    st->span_regex_state = 0;
+}
 
+static void sort_matches(FuzzyState *st, int *indices, int count) {
 #if defined(__APPLE__) || defined(__FreeBSD__)
-    qsort_r(st->match_indices, (size_t)st->match_count, sizeof(int), st, compare_scores_bsd);
+    qsort_r(indices, (size_t)count, sizeof(int), st, compare_scores_bsd);
 #elif defined(__linux__) || defined(_GNU_SOURCE)
-    qsort_r(st->match_indices, (size_t)st->match_count, sizeof(int), compare_scores_gnu, st);
+    qsort_r(indices, (size_t)count, sizeof(int), compare_scores_gnu, st);
 #else
     g_sort_ctx = st;
-    qsort(st->match_indices, (size_t)st->match_count, sizeof(int), compare_scores_static);
+    qsort(indices, (size_t)count, sizeof(int), compare_scores_static);
     g_sort_ctx = NULL;
 #endif
-
-    st->selected = 0;
-    st->scroll_offset = 0;
 }
 
-static void add_line(FuzzyState *st, const char *s) {
-    if (st->line_count >= MAX_LINES) return;
-    if (!s || !*s) return;
+// Quickselect: rearranges arr so that arr[0..k) hold its k best entries, in
+// no particular order, and everything after ranks below them.
+static void select_top(FuzzyState *st, int *arr, int n, int k) {
+    if (k <= 0 || k >= n) return;
+
+    int lo = 0, hi = n - 1;
+    int target = k - 1;
+
+    while (lo < hi) {
+        int mid = lo + (hi - lo) / 2;
+        if (compare_scores(&arr[mid], &arr[lo], st) < 0) { int t = arr[mid]; arr[mid] = arr[lo]; arr[lo] = t; }
+        if (compare_scores(&arr[hi], &arr[lo], st) < 0) { int t = arr[hi]; arr[hi] = arr[lo]; arr[lo] = t; }
+        if (compare_scores(&arr[hi], &arr[mid], st) < 0) { int t = arr[hi]; arr[hi] = arr[mid]; arr[mid] = t; }
+        int pivot = arr[mid];
+
+        int i = lo, j = hi;
+        while (i <= j) {
+            while (compare_scores(&arr[i], &pivot, st) < 0) i++;
+            while (compare_scores(&arr[j], &pivot, st) > 0) j--;
+            if (i <= j) {
+                int t = arr[i]; arr[i] = arr[j]; arr[j] = t;
+                i++;
+                j--;
+            }
+        }
 
-    size_t s_len = strlen(s);
-    if (s_len >= MAX_LINE_LEN) {
-        fprintf(stderr, "Warning: line too long (%zu bytes), truncating\n", s_len);
+        if (target <= j) hi = j;
+        else if (target >= i) lo = i;
+        else break;
     }
+}
 
-    char *raw = strdup(s);
-    if (!raw) {
-        fprintf(stderr, "Warning: failed to allocate memory for raw line\n");
-        return;
+// Orders the best min(count, RANK_TOPK) entries of arr and returns how many.
+// --count never looks at the order, so it skips ranking altogether.
+static int rank_top(FuzzyState *st, int *arr, int count) {
+    if (st->count_only) return 0;
+
+    int k = count < RANK_TOPK ? count : RANK_TOPK;
+    select_top(st, arr, count, k);
+    sort_matches(st, arr, k);
+    return k;
+}
+
+// Makes match_indices[0..upto) final. The prefix at least doubles each time
+// so scrolling through a long list costs amortised O(n) selections.
+static void ensure_sorted(FuzzyState *st, int upto) {
+    if (upto > st->match_count) upto = st->match_count;
+    if (upto <= st->sorted_count) return;
+
+    int target = st->sorted_count * 2;
+    if (target < RANK_TOPK) target = RANK_TOPK;
+    if (target < upto) target = upto;
+    if (target > st->match_count) target = st->match_count;
+
+    int *rest = st->match_indices + st->sorted_count;
+    int k = target - st->sorted_count;
+    select_top(st, rest, st->match_count - st->sorted_count, k);
+    sort_matches(st, rest, k);
+    st->sorted_count = target;
+}
+
+static int deque_pop_front(uint64_t *dq, int *chunk) {
+    uint64_t old = __atomic_load_n(dq, __ATOMIC_ACQUIRE);
+    for (;;) {
+        uint32_t head = (uint32_t)(old >> 32);
+        uint32_t tail = (uint32_t)old;
+        if (head >= tail) return 0;
+
+        uint64_t next = ((uint64_t)(head + 1) << 32) | tail;
+        if (__atomic_compare_exchange_n(dq, &old, next, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+            *chunk = (int)head;
+            return 1;
+        }
     }
+}
 
-    char clean[MAX_LINE_LEN];
-    strip_ansi(s, clean, sizeof(clean));
+static int deque_steal_back(uint64_t *dq, int *chunk) {
+    uint64_t old = __atomic_load_n(dq, __ATOMIC_ACQUIRE);
+    for (;;) {
+        uint32_t head = (uint32_t)(old >> 32);
+        uint32_t tail = (uint32_t)old;
+        if (head >= tail) return 0;
 
-    char *plain = strdup(clean);
-    if (!plain) {
-        fprintf(stderr, "Warning: failed to allocate memory for line\n");
-        free(raw);
-        return;
+        uint64_t next = ((uint64_t)head << 32) | (tail - 1);
+        if (__atomic_compare_exchange_n(dq, &old, next, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+            *chunk = (int)(tail - 1);
+            return 1;
+        }
     }
+}
+
+static void pool_work(WorkPool *pool, int self) {
+    PoolWorker *w = &pool->workers[self];
+    int chunk;
+
+    for (;;) {
+        if (!deque_pop_front(&w->deque, &chunk)) {
+            int stolen = 0;
+            for (int k = 1; k < pool->nthreads && !stolen; k++) {
+                int victim = (self + k) % pool->nthreads;
+                stolen = deque_steal_back(&pool->workers[victim].deque, &chunk);
+            }
+            if (!stolen) break;
+        }
 
-    if (!st->ansi_render && has_ansi_escape(s)) {
-        st->ansi_render = 1;
+        int begin = chunk * pool->grain;
+        int end = begin + pool->grain;
+        if (end > pool->n) end = pool->n;
+        pool->fn(pool->ctx, w, begin, end);
     }
 
-    st->raw_lines[st->line_count] = raw;
-    st->lines[st->line_count] = plain;
-    st->line_count++;
+    if (pool->done_fn) pool->done_fn(pool->ctx, w);
 }
 
-static void add_line_grep(FuzzyState *st, const char *filename, int line_num, const char *content) {
-    if (st->line_count >= MAX_LINES) return;
-    if (!content || !*content) return;
-
-    char formatted[MAX_LINE_LEN];
-    snprintf(formatted, sizeof(formatted), "%s:%d:%s", filename, line_num, content);
+typedef struct {
+    WorkPool *pool;
+    int self;
+} PoolThreadArg;
+
+static void *pool_thread_main(void *arg) {
+    WorkPool *pool = ((PoolThreadArg*)arg)->pool;
+    int self = ((PoolThreadArg*)arg)->self;
+    free(arg);
+
+    unsigned seen = 0;
+    pthread_mutex_lock(&pool->lock);
+    for (;;) {
+        while (!pool->shutdown && pool->job_gen == seen) {
+            pthread_cond_wait(&pool->start_cv, &pool->lock);
+        }
+        if (pool->shutdown) break;
+        seen = pool->job_gen;
+        pthread_mutex_unlock(&pool->lock);
 
-    add_line(st, formatted);
+        pool_work(pool, self);
 
-    if (st->line_numbers) {
-        st->line_numbers[st->line_count - 1] = line_num;
+        pthread_mutex_lock(&pool->lock);
+        if (--pool->pending == 0) pthread_cond_signal(&pool->done_cv);
     }
+    pthread_mutex_unlock(&pool->lock);
+    return NULL;
 }
 
-static void load_stream(FuzzyState *st, FILE *fp) {
-    char line[MAX_LINE_LEN];
-    while (fgets(line, sizeof(line), fp) && st->line_count < MAX_LINES) {
-        size_t len = strlen(line);
+static int pool_start(WorkPool *pool, int nthreads) {
+    if (pool->started) return pool->nthreads > 1;
+    pool->started = 1;
+    pool->nthreads = 1;
 
-        if (len > 0 && len == MAX_LINE_LEN - 1 && line[len - 1] != '\n') {
-            int ch;
-            while ((ch = fgetc(fp)) != EOF && ch != '\n') {}
-            fprintf(stderr, "Warning: line truncated (exceeds %d bytes)\n", MAX_LINE_LEN);
+    if (nthreads <= 0) {
+        long online = sysconf(_SC_NPROCESSORS_ONLN);
+        nthreads = online > 0 ? (int)(online < POOL_MAX_THREADS ? online : POOL_MAX_THREADS) : 1;
+    }
+    if (nthreads < 1) nthreads = 1;
+    if (nthreads > POOL_MAX_THREADS) nthreads = POOL_MAX_THREADS;
+
+    pool->workers = (PoolWorker*)calloc((size_t)nthreads, sizeof(PoolWorker));
+    if (!pool->workers) return 0;
+    if (nthreads == 1) return 0;
+
+    pool->threads = (pthread_t*)calloc((size_t)nthreads, sizeof(pthread_t));
+    if (!pool->threads) return 0;
+
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->start_cv, NULL);
+    pthread_cond_init(&pool->done_cv, NULL);
+
+    // Worker 0 is whichever thread calls pool_run.
+    for (int i = 1; i < nthreads; i++) {
+        PoolThreadArg *arg = (PoolThreadArg*)malloc(sizeof(PoolThreadArg));
+        if (!arg) break;
+        arg->pool = pool;
+        arg->self = i;
+        if (pthread_create(&pool->threads[i], NULL, pool_thread_main, arg) != 0) {
+            free(arg);
+            break;
         }
+        pool->nthreads = i + 1;
+    }
 
-        while (len > 0 && (line[len - 1] == '\n' || line[len - 1] == '\r')) {
-            line[--len] = '\0';
-        }
-        if (len == 0) continue;
+    return pool->nthreads > 1;
+}
 
-        add_line(st, line);
+// Splits [0, n) into chunks of `grain` items, deals each worker an even
+// contiguous share and lets idle workers steal from the back of busy ones.
+// Blocks until every worker has run done_fn.
+static void pool_run(WorkPool *pool, int n, int grain, PoolChunkFn fn, PoolDoneFn done_fn, void *ctx) {
+    int nchunks = (n + grain - 1) / grain;
+    int workers = pool->nthreads;
+
+    pool->grain = grain;
+    pool->fn = fn;
+    pool->done_fn = done_fn;
+    pool->ctx = ctx;
+    pool->n = n;
+    pool->nchunks = nchunks;
+
+    for (int i = 0; i < workers; i++) {
+        uint64_t head = (uint64_t)((long long)nchunks * i / workers);
+        uint64_t tail = (uint64_t)((long long)nchunks * (i + 1) / workers);
+        pool->workers[i].deque = (head << 32) | tail;
     }
-}
 
-static void load_file_grep(FuzzyState *st, const char *filename) {
-    FILE *fp = fopen(filename, "r");
-    if (!fp) {
-        fprintf(stderr, "Warning: failed to open '%s': %s\n", filename, strerror(errno));
+    if (workers == 1) {
+        pool_work(pool, 0);
         return;
     }
 
-    char line[MAX_LINE_LEN];
-    int line_num = 1;
+    pthread_mutex_lock(&pool->lock);
+    pool->pending = workers - 1;
+    pool->job_gen++;
+    pthread_cond_broadcast(&pool->start_cv);
+    pthread_mutex_unlock(&pool->lock);
 
-    while (fgets(line, sizeof(line), fp) && st->line_count < MAX_LINES) {
-        size_t len = strlen(line);
+    pool_work(pool, 0);
 
-        if (len > 0 && len == MAX_LINE_LEN - 1 && line[len - 1] != '\n') {
-            int ch;
-            while ((ch = fgetc(fp)) != EOF && ch != '\n') {}
-        }
+    pthread_mutex_lock(&pool->lock);
+    while (pool->pending > 0) pthread_cond_wait(&pool->done_cv, &pool->lock);
+    pthread_mutex_unlock(&pool->lock);
+}
 
-        while (len > 0 && (line[len - 1] == '\n' || line[len - 1] == '\r')) {
-            line[--len] = '\0';
-        }
+static void pool_destroy(WorkPool *pool) {
+    if (pool->nthreads > 1) {
+        pthread_mutex_lock(&pool->lock);
+        pool->shutdown = 1;
+        pthread_cond_broadcast(&pool->start_cv);
+        pthread_mutex_unlock(&pool->lock);
 
-        if (len > 0) {
-            add_line_grep(st, filename, line_num, line);
-        }
+        for (int i = 1; i < pool->nthreads; i++) pthread_join(pool->threads[i], NULL);
+
+        pthread_mutex_destroy(&pool->lock);
+        pthread_cond_destroy(&pool->start_cv);
+        pthread_cond_destroy(&pool->done_cv);
+    }
 
-        line_num++;
+    if (pool->workers) {
+        for (int i = 0; i < pool->nthreads; i++) {
+            PoolWorker *w = &pool->workers[i];
+            free(w->matches);
+            free(w->rejects);
+            if (w->regex_state > 0) regfree(&w->regex);
+            align_free(&w->align);
+        }
     }
 
-    fclose(fp);
+    free(pool->workers);
+    free(pool->threads);
+    memset(pool, 0, sizeof(*pool));
 }
 
-static void clear_lines(FuzzyState *st) {
-    for (int i = 0; i < st->line_count; i++) {
-        free(st->lines[i]);
-        free(st->raw_lines[i]);
-        st->lines[i] = NULL;
-        st->raw_lines[i] = NULL;
+static int push_index(int **arr, int *count, int *cap, int idx) {
+    if (*count == *cap) {
+        int ncap = *cap ? *cap * 2 : 1024;
+        int *grown = (int*)realloc(*arr, (size_t)ncap * sizeof(int));
+        if (!grown) return 0;
+        *arr = grown;
+        *cap = ncap;
     }
-    st->line_count = 0;
+    (*arr)[(*count)++] = idx;
+    return 1;
 }
 
-static void load_directory(FuzzyState *st, const char *path) {
-    DIR *dir = opendir(path);
-    if (!dir) {
-        fprintf(stderr, "Failed to open directory: %s\n", path);
-        return;
+// A scan over `cand` (cand_count explicit line indices) followed by the line
+// range [from, from + n - cand_count).
+typedef struct {
+    FuzzyState *st;
+    const int *cand;
+    int cand_count;
+    int from;
+} ScoreJob;
+
+static inline int scan_cancelled(const FuzzyState *st) {
+    return st->cancel && __atomic_load_n(st->cancel, __ATOMIC_RELAXED);
+}
+
+static inline int score_job_line(const ScoreJob *job, int item) {
+    return item < job->cand_count ? job->cand[item] : job->from + (item - job->cand_count);
+}
+
+// glibc serialises regexec on a shared regex_t, so each worker compiles its
+// own copy of the pattern for the duration of a scan.
+static int score_line_worker(FuzzyState *st, PoolWorker *w, int idx) {
+    if (st->match_mode != MATCH_REGEX || st->query_len == 0) return score_line(st, idx, &w->align);
+
+    if (w->regex_state == 0) {
+        int flags = REG_EXTENDED | REG_NOSUB;
+        if (!st->case_sensitive) flags |= REG_ICASE;
+        w->regex_state = regcomp(&w->regex, st->query, flags) == 0 ? 1 : -1;
     }
+    if (w->regex_state < 0) return -1;
 
-    clear_lines(st);
+    const char *line = line_plain(st, idx);
+    line += grep_label_len(st, line, (int)store_rec(&st->store, idx)->plain_len);
+    return regexec(&w->regex, line, 0, NULL, 0) == 0 ? 1000 : -1;
+}
 
-    struct dirent *entry;
-    int skipped = 0;
+static void score_job_chunk(void *ctx, PoolWorker *w, int begin, int end) {
+    ScoreJob *job = (ScoreJob*)ctx;
+    FuzzyState *st = job->st;
+    if (scan_cancelled(st) || w->failed) return;
 
-    while ((entry = readdir(dir)) != NULL) {
-        if (st->line_count >= MAX_LINES) {
-            skipped++;
-            continue;
+    for (int item = begin; item < end; item++) {
+        int idx = score_job_line(job, item);
+        int score = score_line_worker(st, w, idx);
+
+        st->scores[idx] = score;
+        int ok = 1;
+        if (score >= 0) ok = push_index(&w->matches, &w->match_count, &w->match_cap, idx);
+        else if (score != SCORE_NONE) ok = push_index(&w->rejects, &w->reject_count, &w->reject_cap, idx);
+        if (!ok) {
+            w->failed = 1;
+            return;
         }
+    }
+}
 
-        if (strcmp(entry->d_name, ".") == 0) continue;
+static void score_job_done(void *ctx, PoolWorker *w) {
+    ScoreJob *job = (ScoreJob*)ctx;
+    w->sorted_count = rank_top(job->st, w->matches, w->match_count);
 
-        int is_parent = (strcmp(entry->d_name, "..") == 0);
+    if (w->regex_state > 0) regfree(&w->regex);
+    w->regex_state = 0;
+}
 
-        if (!st->show_hidden && !is_parent && entry->d_name[0] == '.') {
-            continue;
+// k-way merge of the workers' locally ranked prefixes, driven by a small
+// binary heap over the list heads. The global top RANK_TOPK is contained in
+// the union of the local ones, so the first RANK_TOPK merged entries are
+// final; everything the merge did not reach is appended unordered.
+static int merge_worker_matches(FuzzyState *st, WorkPool *pool, int *out, int *sorted_out) {
+    int heap[POOL_MAX_THREADS];
+    int pos[POOL_MAX_THREADS];
+    int hn = 0;
+
+    for (int i = 0; i < pool->nthreads; i++) {
+        pos[i] = 0;
+        if (pool->workers[i].sorted_count > 0) heap[hn++] = i;
+    }
+
+#define HEAD(k) (&pool->workers[heap[k]].matches[pos[heap[k]]])
+    for (int i = hn / 2 - 1; i >= 0; i--) {
+        for (int k = i;;) {
+            int l = 2 * k + 1, r = l + 1, m = k;
+            if (l < hn && compare_scores(HEAD(l), HEAD(m), st) < 0) m = l;
+            if (r < hn && compare_scores(HEAD(r), HEAD(m), st) < 0) m = r;
+            if (m == k) break;
+            int t = heap[k]; heap[k] = heap[m]; heap[m] = t;
+            k = m;
         }
+    }
 
-        char full_path[PATH_MAX];
-        snprintf(full_path, sizeof(full_path), "%s/%s", path, entry->d_name);
+    int count = 0;
+    while (hn > 0 && count < RANK_TOPK) {
+        PoolWorker *w = &pool->workers[heap[0]];
+        out[count++] = w->matches[pos[heap[0]]++];
 
-        struct stat st_buf;
+        if (pos[heap[0]] == w->sorted_count) heap[0] = heap[--hn];
 
-        if (is_parent) {
-            add_line(st, "../");
-        } else if (stat(full_path, &st_buf) == 0) {
-            if (S_ISDIR(st_buf.st_mode)) {
-                char dir_entry[MAX_LINE_LEN];
-                snprintf(dir_entry, sizeof(dir_entry), "%s/", entry->d_name);
-                add_line(st, dir_entry);
-            } else {
-                if (st_buf.st_mode & S_IXUSR) {
-                    char exec_entry[MAX_LINE_LEN];
-                    snprintf(exec_entry, sizeof(exec_entry), "%s*", entry->d_name);
-                    add_line(st, exec_entry);
-                } else {
-                    add_line(st, entry->d_name);
-                }
-            }
+        for (int k = 0;;) {
+            int l = 2 * k + 1, r = l + 1, m = k;
+            if (l < hn && compare_scores(HEAD(l), HEAD(m), st) < 0) m = l;
+            if (r < hn && compare_scores(HEAD(r), HEAD(m), st) < 0) m = r;
+            if (m == k) break;
+            int t = heap[k]; heap[k] = heap[m]; heap[m] = t;
+            k = m;
         }
     }
+#undef HEAD
 
-    closedir(dir);
+    *sorted_out = count;
 
-    if (skipped > 0) {
-        fprintf(stderr, "Warning: %d entries skipped (MAX_LINES reached)\n", skipped);
+    for (int i = 0; i < pool->nthreads; i++) {
+        PoolWorker *w = &pool->workers[i];
+        int left = w->match_count - pos[i];
+        memcpy(out + count, w->matches + pos[i], (size_t)left * sizeof(int));
+        count += left;
     }
+
+    return count;
 }
 
-static char *sh_sq(const char *in) {
-    if (!in) return NULL;
+// Scores the given candidates and line range, writes the matches to `out`
+// (the first *sorted_out of them ranked, the rest below them in no order) and
+// appends near misses to reject_indices. Returns the match count.
+static int score_lines(FuzzyState *st, const int *cand, int cand_count, int from, int to,
+                       int *out, int *sorted_out) {
+    int n = cand_count + (to - from);
+    ScoreJob job = { st, cand, cand_count, from };
 
-    size_t len = strlen(in);
-    size_t extra = 0;
-    for (size_t i = 0; i < len; i++) {
-        if (in[i] == '\'') extra += 3;
+    if (st->query_len == 0) {
+        for (int item = 0; item < n; item++) {
+            int idx = score_job_line(&job, item);
+            st->scores[idx] = 1000;
+            out[item] = idx;
+        }
+        *sorted_out = n;
+        return n;
     }
 
-    char *out = (char*)malloc(len + extra + 3);
-    if (!out) return NULL;
+    st->query_sig = char_signature(st->query, (size_t)st->query_len);
 
-    char *p = out;
-    *p++ = '\'';
-    for (size_t i = 0; i < len; i++) {
-        if (in[i] == '\'') {
-            memcpy(p, "'\\''", 4);
-            p += 4;
-        } else {
-            *p++ = in[i];
+    int parallel = n >= PARALLEL_MIN_LINES && pool_start(&st->pool, st->threads);
+    if (parallel) {
+        WorkPool *pool = &st->pool;
+        for (int i = 0; i < pool->nthreads; i++) {
+            pool->workers[i].match_count = 0;
+            pool->workers[i].reject_count = 0;
+            pool->workers[i].failed = 0;
         }
-    }
-    *p++ = '\'';
-    *p = '\0';
-    return out;
-}
 
-static int parse_ssh_path(const char *path, char *user, size_t user_size,
-                          char *host, size_t host_size,
-                          char *remote_path, size_t remote_path_size) {
-    if (!path || !user || !host || !remote_path) return 0;
+        pool_run(pool, n, POOL_GRAIN, score_job_chunk, score_job_done, &job);
 
-    const char *colon = strchr(path, ':');
-    if (!colon) return 0;
+        // A worker that could not grow its lists dropped matches: rather than
+        // return a short result, score the lot again on this thread, which
+        // writes straight into the preallocated arrays.
+        for (int i = 0; i < pool->nthreads; i++) {
+            if (pool->workers[i].failed) parallel = 0;
+        }
+        if (parallel) {
+            for (int i = 0; i < pool->nthreads; i++) {
+                PoolWorker *w = &pool->workers[i];
+                memcpy(st->reject_indices + st->reject_count, w->rejects, (size_t)w->reject_count * sizeof(int));
+                st->reject_count += w->reject_count;
+            }
 
-    size_t userhost_len = (size_t)(colon - path);
-    if (userhost_len >= 1024) return 0;
+            long merged = now_us();
+            int count = merge_worker_matches(st, pool, out, sorted_out);
+            st->perf.rank_us += now_us() - merged;
+            return count;
+        }
+    }
 
-    char temp[1024];
-    memcpy(temp, path, userhost_len);
-    temp[userhost_len] = '\0';
+    int count = 0;
+    for (int item = 0; item < n; item++) {
+        if ((item & 1023) == 0 && scan_cancelled(st)) break;
 
-    const char *rpath = colon + 1;
+        int idx = score_job_line(&job, item);
+        int score = score_line(st, idx, &st->align);
 
-    const char *at = strchr(temp, '@');
-    if (at) {
-        size_t user_len = (size_t)(at - temp);
-        size_t host_len = userhost_len - user_len - 1;
+        st->scores[idx] = score;
+        if (score >= 0) out[count++] = idx;
+        else if (score != SCORE_NONE) st->reject_indices[st->reject_count++] = idx;
+    }
+    long ranked = now_us();
+    *sorted_out = rank_top(st, out, count);
+    st->perf.rank_us += now_us() - ranked;
+    return count;
+}
 
-        if (user_len >= user_size || host_len >= host_size) return 0;
+static void match_level_free(MatchLevel *lvl) {
+    free(lvl->indices);
+    free(lvl->scores);
+    memset(lvl, 0, sizeof(*lvl));
+}
 
-        memcpy(user, temp, user_len);
-        user[user_len] = '\0';
+static void match_cache_pop(MatchCache *mc) {
+    MatchLevel *lvl = &mc->levels[--mc->depth];
+    mc->entries -= lvl->count;
+    match_level_free(lvl);
+}
 
-        memcpy(host, at + 1, host_len);
-        host[host_len] = '\0';
-    } else {
+static void match_cache_clear(MatchCache *mc) {
+    while (mc->depth > 0) match_cache_pop(mc);
+}
+
+// Caches the current ranked matches plus the near misses collected in
+// reject_indices during the scan that produced them.
+static void match_cache_push(FuzzyState *st) {
+    MatchCache *mc = &st->match_cache;
+    int total = st->match_count + st->reject_count;
+
+    if (mc->depth == MATCH_CACHE_DEPTH) return;
+    if (mc->entries + total > MATCH_CACHE_MAX_ENTRIES) return;
+
+    MatchLevel *lvl = &mc->levels[mc->depth];
+    size_t n = total > 0 ? (size_t)total : 1;
+    lvl->indices = (int*)malloc(n * sizeof(int));
+    lvl->scores = (int*)malloc(n * sizeof(int));
+    if (!lvl->indices || !lvl->scores) {
+        match_level_free(lvl);
+        return;
+    }
+
+    memcpy(lvl->query, st->query, (size_t)st->query_len + 1);
+    lvl->query_len = st->query_len;
+    lvl->line_count = st->line_count;
+    lvl->count = total;
+    lvl->match_count = st->match_count;
+    lvl->sorted_count = st->sorted_count;
+
+    memcpy(lvl->indices, st->match_indices, (size_t)st->match_count * sizeof(int));
+    memcpy(lvl->indices + st->match_count, st->reject_indices, (size_t)st->reject_count * sizeof(int));
+    for (int m = 0; m < total; m++) {
+        lvl->scores[m] = st->scores[lvl->indices[m]];
+    }
+
+    mc->entries += lvl->count;
+    mc->depth++;
+}
+
+// Drops levels that no longer apply to the current query, mode or lines and
+// returns the deepest level whose query is a prefix of the current one.
+static MatchLevel *match_cache_lookup(FuzzyState *st) {
+    MatchCache *mc = &st->match_cache;
+
+    if (mc->mode != st->match_mode || mc->case_sensitive != st->case_sensitive ||
+        mc->store_gen != st->store_gen || st->match_mode == MATCH_REGEX) {
+        match_cache_clear(mc);
+        mc->mode = st->match_mode;
+        mc->case_sensitive = st->case_sensitive;
+        mc->store_gen = st->store_gen;
+    }
+
+    while (mc->depth > 0) {
+        MatchLevel *top = &mc->levels[mc->depth - 1];
+        if (top->query_len <= st->query_len && top->line_count <= st->line_count &&
+            memcmp(top->query, st->query, (size_t)top->query_len) == 0) {
+            return top;
+        }
+        match_cache_pop(mc);
+    }
+    return NULL;
+}
+
+static void extend_matches(FuzzyState *st, int from);
+
+// Rescores for the current query, mode and lines, through the prefix cache
+// where possible. Returns 0 if the scan was cancelled, in which case the
+// result arrays hold nothing usable.
+static int compute_matches(FuzzyState *st) {
+    long started = now_us();
+    st->perf.rank_us = 0;
+
+    st->match_count = 0;
+    st->reject_count = 0;
+
+    MatchLevel *lvl = st->query_len > 0 ? match_cache_lookup(st) : NULL;
+
+    if (st->query_len == 0) {
+        for (int i = 0; i < st->line_count; i++) {
+            st->scores[i] = 1000;
+            st->match_indices[st->match_count++] = i;
+        }
+        st->sorted_count = st->match_count;
+
+    } else if (lvl && lvl->query_len == st->query_len) {
+        // Back to a query we already ranked: restore it, then pick up any
+        // lines that streamed in since it was cached.
+        for (int m = 0; m < lvl->count; m++) {
+            st->scores[lvl->indices[m]] = lvl->scores[m];
+        }
+        memcpy(st->match_indices, lvl->indices, (size_t)lvl->match_count * sizeof(int));
+        st->match_count = lvl->match_count;
+        st->sorted_count = lvl->sorted_count;
+
+        if (lvl->line_count < st->line_count) extend_matches(st, lvl->line_count);
+
+    } else if (lvl) {
+        // The query grew: only the previous candidates (plus lines newer than
+        // that result set) can still match.
+        st->match_count = score_lines(st, lvl->indices, lvl->count, lvl->line_count,
+                                      st->line_count, st->match_indices, &st->sorted_count);
+        if (scan_cancelled(st)) return 0;
+        match_cache_push(st);
+
+    } else {
+        if (st->match_mode == MATCH_REGEX && !st->regex_valid) {
+            // Compile (and report errors) once up front rather than per line.
+            regex_score(st->query, "", st->case_sensitive, &st->regex, &st->regex_valid,
+                        st->regex_error, sizeof(st->regex_error));
+        }
+
+        st->match_count = score_lines(st, NULL, 0, 0, st->line_count,
+                                      st->match_indices, &st->sorted_count);
+        if (scan_cancelled(st)) return 0;
+        if (st->match_mode != MATCH_REGEX) match_cache_push(st);
+    }
+
+    st->perf.update_us = now_us() - started;
+    return !scan_cancelled(st);
+}
+
+// A new result set is in place: highlights are recomputed, the cursor goes
+// back to the top and the scan time is logged.
+static void matches_published(FuzzyState *st) {
+    span_cache_invalidate(st);
+    st->selected = 0;
+    st->scroll_offset = 0;
+
+    if (st->perf.enabled) latency_record(&st->perf.updates, st->perf.update_us);
+}
+
+static void matcher_sync(FuzzyState *st);
+
+// Synchronous rescore. With the matcher running this hands the scan to it
+// and waits, so the UI thread never scores with a pool of its own.
+static void update_matches(FuzzyState *st) {
+    if (st->matcher.active) {
+        matcher_sync(st);
+        return;
+    }
+
+    compute_matches(st);
+    matches_published(st);
+}
+
+// Folds `added` fresh matches stored at match_indices + base, the first
+// `fresh_sorted` of them ranked, into the result list. Those that outrank the
+// last ranked entry are merged into the sorted prefix; the rest join the
+// unordered tail.
+static void merge_fresh_matches(FuzzyState *st, int base, int added, int fresh_sorted) {
+    st->match_count = base + added;
+
+    if (added == 0) return;
+    if (st->query_len == 0) {
+        st->sorted_count = st->match_count;
+        return;
+    }
+    if (st->sorted_count == 0) {
+        // The fresh ranking starts at `base`, so it only becomes the sorted
+        // prefix when nothing precedes it; otherwise ensure_sorted ranks the
+        // whole list on demand.
+        if (base == 0) st->sorted_count = fresh_sorted;
+        return;
+    }
+
+    int sorted = st->sorted_count;
+    int *fresh = st->match_indices + base;
+    int k = 0;
+    for (int i = 0; i < added; i++) {
+        if (compare_scores(&fresh[i], &st->match_indices[sorted - 1], st) < 0) {
+            int t = fresh[k]; fresh[k] = fresh[i]; fresh[i] = t;
+            k++;
+        }
+    }
+    if (k == 0) return;
+
+    int *ahead = (int*)malloc((size_t)k * sizeof(int));
+    if (!ahead) {
+        // Forget the ranking; the next draw re-selects from scratch.
+        st->sorted_count = 0;
+        return;
+    }
+    memcpy(ahead, fresh, (size_t)k * sizeof(int));
+    sort_matches(st, ahead, k);
+
+    // Open a k-wide gap right behind the prefix by moving the first k
+    // unordered entries into the slots the winners came from.
+    int unordered = base - sorted;
+    int *gap = st->match_indices + sorted;
+    if (unordered >= k) memcpy(fresh, gap, (size_t)k * sizeof(int));
+    else memmove(gap + k, gap, (size_t)unordered * sizeof(int));
+
+    // Merge from the back into [0, sorted + k).
+    int a = sorted - 1, b = k - 1, w = sorted + k - 1;
+    while (b >= 0) {
+        if (a >= 0 && compare_scores(&st->match_indices[a], &ahead[b], st) > 0) {
+            st->match_indices[w--] = st->match_indices[a--];
+        } else {
+            st->match_indices[w--] = ahead[b--];
+        }
+    }
+    st->sorted_count = sorted + k;
+
+    free(ahead);
+}
+
+// Scores lines [from, line_count) that arrived after the last update_matches
+// and folds their matches into the ranked list without a full rescan.
+// Selection is left where it is so streaming input does not yank the cursor.
+static void extend_matches(FuzzyState *st, int from) {
+    int base = st->match_count;
+    int saved_rejects = st->reject_count;
+    int fresh_sorted;
+
+    int added = score_lines(st, NULL, 0, from, st->line_count,
+                            st->match_indices + base, &fresh_sorted);
+    st->reject_count = saved_rejects;
+    merge_fresh_matches(st, base, added, fresh_sorted);
+}
+
+// The matcher thread's half of an extend job: scores only the new lines,
+// leaving their matches at the front of match_indices for matcher_poll.
+static int extend_scan(FuzzyState *st, int from) {
+    long started = now_us();
+    st->perf.rank_us = 0;
+    st->reject_count = 0;
+
+    if (st->match_mode == MATCH_REGEX && st->query_len > 0 && !st->regex_valid) {
+        regex_score(st->query, "", st->case_sensitive, &st->regex, &st->regex_valid,
+                    st->regex_error, sizeof(st->regex_error));
+    }
+
+    st->match_count = score_lines(st, NULL, 0, from, st->line_count,
+                                  st->match_indices, &st->sorted_count);
+    st->perf.update_us = now_us() - started;
+    return !scan_cancelled(st);
+}
+
+static void *matcher_thread_main(void *arg) {
+    Matcher *m = (Matcher*)arg;
+
+    pthread_mutex_lock(&m->lock);
+    for (;;) {
+        while (!m->shutdown && !m->start) pthread_cond_wait(&m->cv, &m->lock);
+        if (m->shutdown) break;
+        m->start = 0;
+        pthread_mutex_unlock(&m->lock);
+
+        int ok = m->extend_from >= 0 ? extend_scan(m->scan, m->extend_from)
+                                      : compute_matches(m->scan);
+
+        pthread_mutex_lock(&m->lock);
+        m->completed = ok;
+        m->finished = 1;
+        pthread_cond_broadcast(&m->cv);
+
+        char b = 1;
+        ssize_t w = write(m->wake[1], &b, 1);
+        (void)w;
+    }
+    pthread_mutex_unlock(&m->lock);
+    return NULL;
+}
+
+// Starts the matcher thread. On failure scans keep running inline.
+static int matcher_start(FuzzyState *st) {
+    Matcher *m = &st->matcher;
+
+    FuzzyState *scan = (FuzzyState*)calloc(1, sizeof(FuzzyState));
+    if (!scan) return 0;
+    scan->threads = st->threads;
+    scan->grep_mode = st->grep_mode;
+    scan->cancel = &m->cancel;
+
+    if (pipe(m->wake) != 0) {
+        free(scan);
+        return 0;
+    }
+    fcntl(m->wake[0], F_SETFL, O_NONBLOCK);
+    fcntl(m->wake[1], F_SETFL, O_NONBLOCK);
+
+    pthread_mutex_init(&m->lock, NULL);
+    pthread_cond_init(&m->cv, NULL);
+    m->scan = scan;
+
+    if (pthread_create(&m->thread, NULL, matcher_thread_main, m) != 0) {
+        pthread_mutex_destroy(&m->lock);
+        pthread_cond_destroy(&m->cv);
+        close(m->wake[0]);
+        close(m->wake[1]);
+        free(scan);
+        m->scan = NULL;
+        return 0;
+    }
+
+    m->active = 1;
+    m->want = m->job = m->shown = 0;
+    return 1;
+}
+
+// Copies what a scan reads into the private state and hands it to the thread.
+// With `extend_from` >= 0 only the lines from there on are scored, for
+// matcher_poll to merge into the current results.
+static void matcher_begin(FuzzyState *st, int extend_from) {
+    Matcher *m = &st->matcher;
+    FuzzyState *sc = m->scan;
+
+    if (!ensure_line_capacity(sc, st->line_count)) {
+        // No room for the private copy. An extend job's caller scores the
+        // lines itself; anything else is scanned right here so results
+        // never silently go stale.
+        if (extend_from >= 0) return;
+        compute_matches(st);
+        matches_published(st);
+        m->job = m->shown = m->want;
+        return;
+    }
+
+    // Scans only look lines up through the chunk and slab tables, which never
+    // move once allocated; the rest of the store may be changing under the
+    // reader thread, so only those two pointers are shared.
+    sc->store.chunks = st->store.chunks;
+    sc->store.arena.slabs = st->store.arena.slabs;
+    sc->store_gen = st->store_gen;
+    sc->line_count = st->line_count;
+
+    memcpy(sc->query, st->query, sizeof(st->query));
+    sc->query_len = st->query_len;
+    sc->match_mode = st->match_mode;
+    sc->case_sensitive = st->case_sensitive;
+    sc->algo = st->algo;
+
+    if (sc->regex_valid > 0) regfree(&sc->regex);
+    sc->regex_valid = 0;
+
+    m->job = m->want;
+    m->extend_from = extend_from;
+    m->busy = 1;
+    __atomic_store_n(&m->cancel, 0, __ATOMIC_RELAXED);
+
+    pthread_mutex_lock(&m->lock);
+    m->finished = 0;
+    m->start = 1;
+    pthread_cond_signal(&m->cv);
+    pthread_mutex_unlock(&m->lock);
+}
+
+// Swaps the scan's result arrays in for the live ones.
+static void matcher_publish(FuzzyState *st) {
+    FuzzyState *sc = st->matcher.scan;
+    int *t;
+
+    t = st->scores;         st->scores = sc->scores;                 sc->scores = t;
+    t = st->match_indices;  st->match_indices = sc->match_indices;   sc->match_indices = t;
+    t = st->reject_indices; st->reject_indices = sc->reject_indices; sc->reject_indices = t;
+
+    // Each side may now hold the other's smaller arrays; only claim that much.
+    int cap = st->line_cap < sc->line_cap ? st->line_cap : sc->line_cap;
+    st->line_cap = cap;
+    sc->line_cap = cap;
+
+    st->match_count = sc->match_count;
+    st->sorted_count = sc->sorted_count;
+    st->reject_count = sc->reject_count;
+    st->query_sig = sc->query_sig;
+    st->perf.update_us = sc->perf.update_us;
+    st->perf.rank_us = sc->perf.rank_us;
+
+    if (sc->regex_valid < 0) {
+        if (st->regex_valid > 0) regfree(&st->regex);
+        st->regex_valid = -1;
+        memcpy(st->regex_error, sc->regex_error, sizeof(st->regex_error));
+    }
+
+    matches_published(st);
+}
+
+// Merges a finished extend job into the live results. The job ran against the
+// query they were scored with, and line_count has not moved since it began.
+static void matcher_merge(FuzzyState *st) {
+    FuzzyState *sc = st->matcher.scan;
+    int from = st->matcher.extend_from;
+    int base = st->match_count;
+
+    memcpy(st->scores + from, sc->scores + from,
+           (size_t)(sc->line_count - from) * sizeof(int));
+    memcpy(st->match_indices + base, sc->match_indices,
+           (size_t)sc->match_count * sizeof(int));
+    merge_fresh_matches(st, base, sc->match_count, sc->sorted_count);
+}
+
+// Collects a finished scan and publishes it if nothing newer was asked for
+// meanwhile. Returns 1 if results changed.
+static int matcher_poll(FuzzyState *st) {
+    Matcher *m = &st->matcher;
+    if (!m->busy) return 0;
+
+    pthread_mutex_lock(&m->lock);
+    int finished = m->finished;
+    int completed = m->completed;
+    pthread_mutex_unlock(&m->lock);
+    if (!finished) return 0;
+
+    char buf[64];
+    while (read(m->wake[0], buf, sizeof(buf)) > 0) {}
+    m->busy = 0;
+
+    // Lines a cancelled extend job was scoring are already counted, so only a
+    // full rescan picks them up now.
+    if (!completed && m->extend_from >= 0 && m->job == m->want) m->want++;
+
+    if (!completed || m->job != m->want) return 0;
+    if (m->extend_from >= 0) matcher_merge(st);
+    else matcher_publish(st);
+    m->shown = m->job;
+    return 1;
+}
+
+// Cancels the scan in flight and waits for the thread to let go of the store.
+static void matcher_stop(FuzzyState *st) {
+    Matcher *m = &st->matcher;
+    if (!m->busy) return;
+
+    __atomic_store_n(&m->cancel, 1, __ATOMIC_RELAXED);
+    pthread_mutex_lock(&m->lock);
+    while (!m->finished) pthread_cond_wait(&m->cv, &m->lock);
+    pthread_mutex_unlock(&m->lock);
+
+    matcher_poll(st);
+}
+
+static void matcher_sync(FuzzyState *st) {
+    Matcher *m = &st->matcher;
+
+    m->want++;
+    matcher_stop(st);
+    matcher_begin(st, -1);
+    if (!m->busy) return;
+
+    pthread_mutex_lock(&m->lock);
+    while (!m->finished) pthread_cond_wait(&m->cv, &m->lock);
+    pthread_mutex_unlock(&m->lock);
+
+    matcher_poll(st);
+}
+
+// Query edits only note that a rescan is due and cancel the one in flight;
+// the main loop starts the next scan once the pending keys are drained.
+static void request_matches(FuzzyState *st) {
+    Matcher *m = &st->matcher;
+    // -G searches again instead; see grep_kick.
+    if (st->grep_mode) {
+        st->grep.want++;
+        return;
+    }
+
+    if (!m->active) {
+        update_matches(st);
+        return;
+    }
+
+    m->want++;
+    if (m->busy) __atomic_store_n(&m->cancel, 1, __ATOMIC_RELAXED);
+}
+
+static void matcher_kick(FuzzyState *st) {
+    Matcher *m = &st->matcher;
+    if (m->active && !m->busy && m->want != m->shown) matcher_begin(st, -1);
+}
+
+// The live results are current: no scan pending and none in flight.
+static int matcher_current(const FuzzyState *st) {
+    const Matcher *m = &st->matcher;
+    return !m->active || (!m->busy && m->want == m->shown);
+}
+
+static void matcher_shutdown(FuzzyState *st) {
+    Matcher *m = &st->matcher;
+    if (!m->active) return;
+
+    matcher_stop(st);
+
+    pthread_mutex_lock(&m->lock);
+    m->shutdown = 1;
+    pthread_cond_signal(&m->cv);
+    pthread_mutex_unlock(&m->lock);
+    pthread_join(m->thread, NULL);
+
+    pthread_mutex_destroy(&m->lock);
+    pthread_cond_destroy(&m->cv);
+    close(m->wake[0]);
+    close(m->wake[1]);
+
+    FuzzyState *sc = m->scan;
+    match_cache_clear(&sc->match_cache);
+    pool_destroy(&sc->pool);
+    align_free(&sc->align);
+    if (sc->regex_valid > 0) regfree(&sc->regex);
+    free(sc->scores);
+    free(sc->match_indices);
+    free(sc->reject_indices);
+    free(sc);
+
+    m->scan = NULL;
+    m->active = 0;
+}
+
+static int line_reader_open(LineReader *r, FILE *fp) {
+    memset(r, 0, sizeof(*r));
+    r->fd = fileno(fp);
+    if (r->fd < 0) return 0;
+
+    r->buf = (char*)malloc(LINE_READER_BLOCK);
+    if (!r->buf) return 0;
+    r->cap = LINE_READER_BLOCK;
+
+#if defined(POSIX_FADV_SEQUENTIAL)
+    struct stat sb;
+    if (fstat(r->fd, &sb) == 0 && S_ISREG(sb.st_mode)) {
+        posix_fadvise(r->fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+    }
+#endif
+    return 1;
+}
+
+static void line_reader_close(LineReader *r) {
+    free(r->buf);
+    r->buf = NULL;
+}
+
+// Returns the next line with its trailing CR/LF removed, or NULL at end of
+// input. The pointer stays valid until the next call; *len_out excludes the
+// terminator, which is written in place.
+static char *line_reader_next(LineReader *r, size_t *len_out) {
+    for (;;) {
+        char *nl = r->scan < r->end
+            ? (char*)memchr(r->buf + r->scan, '\n', r->end - r->scan)
+            : NULL;
+
+        size_t line_end;
+        if (nl) {
+            line_end = (size_t)(nl - r->buf);
+        } else if (r->eof) {
+            if (r->start == r->end) return NULL;
+            line_end = r->end;
+            // Room for the terminator: the buffer always keeps one spare byte.
+        } else {
+            // Compact, grow when a single line fills the buffer, then refill.
+            if (r->start > 0) {
+                memmove(r->buf, r->buf + r->start, r->end - r->start);
+                r->end -= r->start;
+                r->start = 0;
+            }
+            r->scan = r->end;
+
+            if (r->end + 1 >= r->cap) {
+                char *buf = (char*)realloc(r->buf, r->cap * 2);
+                if (!buf) {
+                    // Out of memory: hand back what we have as one line.
+                    r->eof = 1;
+                    continue;
+                }
+                r->buf = buf;
+                r->cap *= 2;
+            }
+
+            if (r->before_read) r->before_read(r->before_read_arg);
+            ssize_t n = read(r->fd, r->buf + r->end, r->cap - r->end - 1);
+            if (n < 0 && errno == EINTR) continue;
+            // Non-blocking source with nothing buffered: not the end, just
+            // nothing more for now. eof stays clear so the caller can tell.
+            if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) return NULL;
+            if (n <= 0) r->eof = 1;
+            else {
+                r->end += (size_t)n;
+                r->bytes += (uint64_t)n;
+            }
+            continue;
+        }
+
+        char *line = r->buf + r->start;
+        size_t len = line_end - r->start;
+        r->start = r->scan = nl ? line_end + 1 : line_end;
+
+        while (len > 0 && (line[len - 1] == '\n' || line[len - 1] == '\r')) len--;
+        line[len] = '\0';
+        *len_out = len;
+        return line;
+    }
+}
+
+static void add_line(FuzzyState *st, const char *s) {
+    if (!s || !*s) return;
+    if (!ensure_line_capacity(st, st->line_count + 1)) {
+        fprintf(stderr, "Warning: failed to grow line index\n");
+        return;
+    }
+
+    if (!line_store_add(&st->store, s, strlen(s))) {
+        fprintf(stderr, "Warning: failed to allocate line storage\n");
+        return;
+    }
+
+    st->line_count = st->store.count;
+
+    const LineRec *rec = store_rec(&st->store, st->line_count - 1);
+    if (rec->plain_len != rec->raw_len) st->ansi_render = 1;
+}
+
+static void load_stream(FuzzyState *st, FILE *fp) {
+    LineReader r;
+    if (!line_reader_open(&r, fp)) {
+        fprintf(stderr, "Warning: failed to read input\n");
+        return;
+    }
+
+    char *line;
+    size_t len;
+    while ((line = line_reader_next(&r, &len)) != NULL) {
+        if (len == 0) continue;
+        add_line(st, line);
+    }
+
+    line_reader_close(&r);
+}
+
+static void clear_lines(FuzzyState *st) {
+    matcher_stop(st);
+    st->store_gen++;
+    span_cache_invalidate(st);
+    line_store_clear(&st->store);
+    st->line_count = 0;
+}
+
+// Filesystems where every stat is a network round trip, so lookups are
+// worth overlapping.
+static int is_network_fs(int fd) {
+#if defined(__linux__)
+    struct statfs sf;
+    if (fstatfs(fd, &sf) != 0) return 0;
+
+    switch ((unsigned long)sf.f_type) {
+        case 0x6969UL:      // NFS
+        case 0x517BUL:      // SMB
+        case 0xFF534D42UL:  // CIFS
+        case 0xFE534D42UL:  // SMB2
+        case 0x65735546UL:  // FUSE (sshfs and friends)
+        case 0x00C36400UL:  // Ceph
+        case 0x5346414FUL:  // AFS
+        case 0x73757245UL:  // Coda
+            return 1;
+    }
+#else
+    (void)fd;
+#endif
+    return 0;
+}
+
+// One readdir entry: where its name sits in the name buffer and what it is.
+enum { DIRENT_FILE, DIRENT_EXEC, DIRENT_DIR, DIRENT_UNKNOWN, DIRENT_GONE };
+
+typedef struct {
+    uint32_t name;
+    int kind;
+} DirEntry;
+
+typedef struct {
+    int fd;
+    const char *names;
+    DirEntry *entries;
+    const int *lookups;
+} StatJob;
+
+// Follows symlinks like the stat() it replaces; an entry that cannot be
+// stat'ed (a dangling link, say) is left out of the listing.
+static int dirent_kind_at(int fd, const char *name) {
+    struct stat sb;
+    if (fstatat(fd, name, &sb, 0) != 0) return DIRENT_GONE;
+    if (S_ISDIR(sb.st_mode)) return DIRENT_DIR;
+    return (sb.st_mode & S_IXUSR) ? DIRENT_EXEC : DIRENT_FILE;
+}
+
+static void stat_job_chunk(void *ctx, PoolWorker *w, int begin, int end) {
+    StatJob *job = (StatJob*)ctx;
+    (void)w;
+
+    for (int i = begin; i < end; i++) {
+        DirEntry *e = &job->entries[job->lookups[i]];
+        e->kind = dirent_kind_at(job->fd, job->names + e->name);
+    }
+}
+
+#define STAT_POOL_THREADS 8
+#define STAT_POOL_GRAIN   16
+
+// Resolves entries whose type readdir could not tell (DT_UNKNOWN, and
+// symlinks, which may point at directories). On a network filesystem with
+// enough of them the lookups are spread over a small pool so their round
+// trips overlap.
+static void resolve_dirents(FuzzyState *st, int fd, const char *names, DirEntry *entries, int count) {
+    int *lookups = (int*)malloc((size_t)(count > 0 ? count : 1) * sizeof(int));
+    if (!lookups) {
+        for (int i = 0; i < count; i++) {
+            if (entries[i].kind == DIRENT_UNKNOWN) entries[i].kind = dirent_kind_at(fd, names + entries[i].name);
+        }
+        return;
+    }
+
+    int n = 0;
+    for (int i = 0; i < count; i++) {
+        if (entries[i].kind == DIRENT_UNKNOWN) lookups[n++] = i;
+    }
+
+    StatJob job = { fd, names, entries, lookups };
+    if (n >= 4 * STAT_POOL_GRAIN && is_network_fs(fd) && pool_start(&st->stat_pool, STAT_POOL_THREADS)) {
+        pool_run(&st->stat_pool, n, STAT_POOL_GRAIN, stat_job_chunk, NULL, &job);
+    } else {
+        stat_job_chunk(&job, NULL, 0, n);
+    }
+
+    free(lookups);
+}
+
+// Lists a local directory with as few syscalls as the filesystem allows:
+// readdir's d_type sorts out directories and plain files, fstatat against the
+// directory fd covers the rest, and a file's execute bit is only looked up
+// when its row is drawn (see line_exec_bit).
+static void load_directory(FuzzyState *st, const char *path) {
+    int fd = open(path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    DIR *dir = fd >= 0 ? fdopendir(fd) : NULL;
+    if (!dir) {
+        if (fd >= 0) close(fd);
+        fprintf(stderr, "Failed to open directory: %s\n", path);
+        return;
+    }
+
+    clear_lines(st);
+
+    if (st->dir_fd >= 0) close(st->dir_fd);
+    st->dir_fd = fcntl(fd, F_DUPFD_CLOEXEC, 0);
+
+    char *names = NULL;
+    size_t names_used = 0, names_cap = 0;
+    DirEntry *entries = NULL;
+    int count = 0, cap = 0;
+    int unknown = 0;
+
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != NULL) {
+        const char *name = entry->d_name;
+        if (strcmp(name, ".") == 0) continue;
+
+        int is_parent = (strcmp(name, "..") == 0);
+        if (!st->show_hidden && !is_parent && name[0] == '.') continue;
+
+        int kind = DIRENT_UNKNOWN;
+#if defined(DT_DIR) && defined(DT_LNK) && defined(DT_UNKNOWN)
+        if (is_parent || entry->d_type == DT_DIR) kind = DIRENT_DIR;
+        else if (entry->d_type != DT_LNK && entry->d_type != DT_UNKNOWN) kind = DIRENT_FILE;
+#else
+        if (is_parent) kind = DIRENT_DIR;
+#endif
+        if (kind == DIRENT_UNKNOWN) unknown++;
+
+        size_t len = strlen(name) + 1;
+        if (names_used + len > names_cap) {
+            size_t ncap = names_cap ? names_cap * 2 : 64 * 1024;
+            while (ncap < names_used + len) ncap *= 2;
+            char *grown = (char*)realloc(names, ncap);
+            if (!grown) break;
+            names = grown;
+            names_cap = ncap;
+        }
+        if (count == cap) {
+            int ncap = cap ? cap * 2 : 1024;
+            DirEntry *grown = (DirEntry*)realloc(entries, (size_t)ncap * sizeof(DirEntry));
+            if (!grown) break;
+            entries = grown;
+            cap = ncap;
+        }
+
+        memcpy(names + names_used, name, len);
+        entries[count].name = (uint32_t)names_used;
+        entries[count].kind = kind;
+        names_used += len;
+        count++;
+    }
+
+    if (unknown > 0) resolve_dirents(st, fd, names, entries, count);
+
+    for (int i = 0; i < count; i++) {
+        const char *name = names + entries[i].name;
+
+        switch (entries[i].kind) {
+            case DIRENT_DIR: {
+                char dir_entry[MAX_LINE_LEN];
+                snprintf(dir_entry, sizeof(dir_entry), "%s/", name);
+                add_line(st, dir_entry);
+                break;
+            }
+            case DIRENT_FILE:
+            case DIRENT_EXEC: {
+                int before = st->line_count;
+                add_line(st, name);
+                if (st->line_count > before) {
+                    LineRec *rec = store_rec_mut(&st->store, before);
+                    rec->flags = entries[i].kind == DIRENT_EXEC ? LINE_EXEC :
+                                 st->dir_fd >= 0 ? LINE_EXEC_PENDING : 0;
+                }
+                break;
+            }
+            default:
+                break;
+        }
+    }
+
+    free(names);
+    free(entries);
+    closedir(dir);
+}
+
+static char *sh_sq(const char *in) {
+    if (!in) return NULL;
+
+    size_t len = strlen(in);
+    size_t extra = 0;
+    for (size_t i = 0; i < len; i++) {
+        if (in[i] == '\'') extra += 3;
+    }
+
+    char *out = (char*)malloc(len + extra + 3);
+    if (!out) return NULL;
+
+    char *p = out;
+    *p++ = '\'';
+    for (size_t i = 0; i < len; i++) {
+        if (in[i] == '\'') {
+            memcpy(p, "'\\''", 4);
+            p += 4;
+        } else {
+            *p++ = in[i];
+        }
+    }
+    *p++ = '\'';
+    *p = '\0';
+    return out;
+}
+
+static int parse_ssh_path(const char *path, char *user, size_t user_size,
+                          char *host, size_t host_size,
+                          char *remote_path, size_t remote_path_size) {
+    if (!path || !user || !host || !remote_path) return 0;
+
+    const char *colon = strchr(path, ':');
+    if (!colon) return 0;
+
+    size_t userhost_len = (size_t)(colon - path);
+    if (userhost_len >= 1024) return 0;
+
+    char temp[1024];
+    memcpy(temp, path, userhost_len);
+    temp[userhost_len] = '\0';
+
+    const char *rpath = colon + 1;
+
+    const char *at = strchr(temp, '@');
+    if (at) {
+        size_t user_len = (size_t)(at - temp);
+        size_t host_len = userhost_len - user_len - 1;
+
+        if (user_len >= user_size || host_len >= host_size) return 0;
+
+        memcpy(user, temp, user_len);
+        user[user_len] = '\0';
+
+        memcpy(host, at + 1, host_len);
+        host[host_len] = '\0';
+    } else {
         if (userhost_len >= host_size) return 0;
 
-        user[0] = '\0';
-        memcpy(host, temp, userhost_len);
-        host[userhost_len] = '\0';
+        user[0] = '\0';
+        memcpy(host, temp, userhost_len);
+        host[userhost_len] = '\0';
+    }
+
+    size_t rpath_len = strlen(rpath);
+    if (rpath_len >= remote_path_size) return 0;
+
+    memcpy(remote_path, rpath, rpath_len);
+    remote_path[rpath_len] = '\0';
+
+    return 1;
+}
+
+static void ssh_target(const char *user, const char *host, char *out, size_t size) {
+    if (user && user[0]) snprintf(out, size, "%s@%s", user, host);
+    else snprintf(out, size, "%s", host);
+}
+
+// Builds the -o options that route a connection through the shared control
+// master, creating the socket directory on first use. Leaves out empty when
+// multiplexing isn't available so callers just open a plain connection.
+static void ssh_mux_options(FuzzyState *st, const char *target, char *out, size_t size) {
+    SshSession *s = &st->ssh;
+    out[0] = '\0';
+    if (s->unavailable) return;
+
+    if (!s->dir[0]) {
+        const char *tmp = getenv("TMPDIR");
+        if (!tmp || !tmp[0]) tmp = "/tmp";
+        // Socket paths are limited to ~108 bytes; %C adds 40 more.
+        int n = snprintf(s->dir, sizeof(s->dir), "%s/ff-ssh-XXXXXX", tmp);
+        if (n < 0 || n > 60 || !mkdtemp(s->dir)) {
+            s->dir[0] = '\0';
+            s->unavailable = 1;
+            return;
+        }
+    }
+
+    int known = 0;
+    for (int i = 0; i < s->target_count; i++) {
+        if (strcmp(s->targets[i], target) == 0) { known = 1; break; }
+    }
+    if (!known) {
+        char **targets = (char**)realloc(s->targets, (size_t)(s->target_count + 1) * sizeof(char*));
+        if (!targets) return;
+        s->targets = targets;
+        char *copy = strdup(target);
+        if (!copy) return;
+        s->targets[s->target_count++] = copy;
+    }
+
+    char *qdir = sh_sq(s->dir);
+    if (!qdir) return;
+    // ControlPersist is a backstop in case we die without shutting it down.
+    snprintf(out, size,
+             "-o ControlMaster=auto -o ControlPath=%s/%%C -o ControlPersist=300 ",
+             qdir);
+    free(qdir);
+}
+
+static void ssh_session_close(FuzzyState *st) {
+    SshSession *s = &st->ssh;
+    if (s->dir[0]) {
+        char *qdir = sh_sq(s->dir);
+        for (int i = 0; qdir && i < s->target_count; i++) {
+            char cmd[PATH_MAX + 1024];
+            int n = snprintf(cmd, sizeof(cmd),
+                             "ssh -o ControlPath=%s/%%C -O exit %s >/dev/null 2>&1",
+                             qdir, s->targets[i]);
+            if (n > 0 && n < (int)sizeof(cmd) && system(cmd) == -1) break;
+        }
+        free(qdir);
+
+        DIR *dir = opendir(s->dir);
+        if (dir) {
+            struct dirent *e;
+            while ((e = readdir(dir)) != NULL) {
+                if (e->d_name[0] == '.') continue;
+                unlinkat(dirfd(dir), e->d_name, 0);
+            }
+            closedir(dir);
+        }
+        rmdir(s->dir);
+        s->dir[0] = '\0';
+    }
+
+    for (int i = 0; i < s->target_count; i++) free(s->targets[i]);
+    free(s->targets);
+    s->targets = NULL;
+    s->target_count = 0;
+    free(s->home);
+    s->home = NULL;
+}
+
+// Builds the complete local command line for running command on user@host.
+static int ssh_command_line(FuzzyState *st, const char *user, const char *host,
+                            const char *command, char *out, size_t size) {
+    if (!host || !host[0] || !command || !command[0]) {
+        return 0;
+    }
+
+    char target[520];
+    ssh_target(user, host, target, sizeof(target));
+
+    char mux[PATH_MAX + 128];
+    ssh_mux_options(st, target, mux, sizeof(mux));
+
+    char *qcmd = sh_sq(command);
+    if (!qcmd) return 0;
+
+    int written = snprintf(out, size,
+                           "ssh -o ConnectTimeout=10 -o BatchMode=yes %s%s %s 2>&1",
+                           mux, target, qcmd);
+
+    free(qcmd);
+
+    if (written < 0 || written >= (int)size) {
+        fprintf(stderr, "SSH command too long\n");
+        return 0;
+    }
+    return 1;
+}
+
+static FILE *ssh_popen(FuzzyState *st, const char *user, const char *host, const char *command) {
+    char ssh_cmd[4096];
+    if (!ssh_command_line(st, user, host, command, ssh_cmd, sizeof(ssh_cmd))) return NULL;
+    return popen(ssh_cmd, "r");
+}
+
+// Full ssh command line that lists path on the current host.
+static int ssh_listing_command(FuzzyState *st, const char *path, int show_hidden,
+                               char *out, size_t size) {
+    char *qpath = quote_dash_safe(path);
+    if (!qpath) {
+        fprintf(stderr, "Out of memory\n");
+        return 0;
+    }
+
+    // If cd fails, emit a sentinel and exit nonzero so we don't "ls ~" by accident.
+    // Types and execute bits are worked out on the remote side in the same
+    // command, so a listing is one round trip however many entries it has:
+    // directories come back as "name/", executables as "name*".
+    const char *ls_flags = show_hidden ? "-A1" : "-1";
+    char ls_cmd[2048];
+    int written = snprintf(ls_cmd, sizeof(ls_cmd),
+        "cd %s 2>/dev/null || { printf '__NBL_CD_FAIL__\\n'; exit 42; }; "
+        "{ ls %s --color=never 2>/dev/null || ls %s 2>/dev/null; } | "
+        "while IFS= read -r f; do "
+        "if [ -d \"$f\" ]; then printf '%%s/\\n' \"$f\"; "
+        "elif [ -x \"$f\" ]; then printf '%%s*\\n' \"$f\"; "
+        "else printf '%%s\\n' \"$f\"; fi; done",
+        qpath, ls_flags, ls_flags
+    );
+
+    free(qpath);
+
+    if (written < 0 || written >= (int)sizeof(ls_cmd)) {
+        fprintf(stderr, "Directory path too long\n");
+        return 0;
+    }
+
+    return ssh_command_line(st, st->ssh_user, st->ssh_host, ls_cmd, out, size);
+}
+
+// Runs a listing command and collects its entries into out->data, each one
+// NUL-terminated. Touches no shared state, so the prefetch worker uses it too.
+// On failure returns 0 with a message in err.
+static int ssh_fetch_listing(const char *cmd, DirCacheEntry *out, char *err, size_t err_size) {
+    out->data = NULL;
+    out->len = 0;
+    err[0] = '\0';
+
+    FILE *fp = popen(cmd, "r");
+    if (!fp) {
+        snprintf(err, err_size, "Failed to run ssh");
+        return 0;
+    }
+
+    LineReader r;
+    if (!line_reader_open(&r, fp)) {
+        pclose(fp);
+        snprintf(err, err_size, "Out of memory");
+        return 0;
+    }
+
+    size_t cap = 0;
+    int ok = 1;
+    char *next;
+    size_t len;
+    while ((next = line_reader_next(&r, &len)) != NULL) {
+        if (len == 0) continue;
+        if (len >= MAX_LINE_LEN - 1) len = MAX_LINE_LEN - 2;
+
+        // Sentinel: cd failed -> don't lie by listing ~
+        if (len == 15 && memcmp(next, "__NBL_CD_FAIL__", 15) == 0) {
+            snprintf(err, err_size, "failed to cd");
+            ok = 0;
+            break;
+        }
+
+        if (len == 1 && next[0] == '.') continue;
+
+        if ((len >= 17 && strncmp(next, "Permission denied", 17) == 0) ||
+            (len >= 18 && strncmp(next, "Connection refused", 18) == 0) ||
+            (len >= 28 && strncmp(next, "Host key verification failed", 28) == 0)) {
+            snprintf(err, err_size, "SSH error: %.*s", (int)len, next);
+            ok = 0;
+            break;
+        }
+
+        if (out->len + len + 1 > cap) {
+            size_t new_cap = cap ? cap * 2 : 4096;
+            while (new_cap < out->len + len + 1) new_cap *= 2;
+            char *data = (char*)realloc(out->data, new_cap);
+            if (!data) {
+                snprintf(err, err_size, "Out of memory");
+                ok = 0;
+                break;
+            }
+            out->data = data;
+            cap = new_cap;
+        }
+        memcpy(out->data + out->len, next, len);
+        out->data[out->len + len] = '\0';
+        out->len += len + 1;
+    }
+
+    line_reader_close(&r);
+    int status = pclose(fp);
+    if (ok && status != 0) {
+        snprintf(err, err_size, "SSH command exited with status %d", WEXITSTATUS(status));
+        ok = 0;
     }
+    if (ok && !out->data) {
+        // An empty directory is still a listing worth caching.
+        out->data = (char*)malloc(1);
+        if (!out->data) ok = 0;
+    }
+    if (!ok) {
+        free(out->data);
+        out->data = NULL;
+        out->len = 0;
+    }
+    return ok;
+}
 
-    size_t rpath_len = strlen(rpath);
-    if (rpath_len >= remote_path_size) return 0;
+static char *dir_cache_key(FuzzyState *st, const char *path, int show_hidden) {
+    char target[520];
+    ssh_target(st->ssh_user, st->ssh_host, target, sizeof(target));
 
-    memcpy(remote_path, rpath, rpath_len);
-    remote_path[rpath_len] = '\0';
+    size_t n = strlen(target) + strlen(path) + 4;
+    char *key = (char*)malloc(n);
+    if (key) snprintf(key, n, "%s\n%d\n%s", target, show_hidden ? 1 : 0, path);
+    return key;
+}
+
+static DirCache *dir_cache_get(FuzzyState *st) {
+    if (st->dir_cache) return st->dir_cache;
+
+    DirCache *c = (DirCache*)calloc(1, sizeof(DirCache));
+    if (!c) return NULL;
+    pthread_mutex_init(&c->lock, NULL);
+    pthread_cond_init(&c->cv, NULL);
+    st->dir_cache = c;
+    return c;
+}
+
+// Caller holds the lock.
+static DirCacheEntry *dir_cache_find(DirCache *c, const char *key) {
+    for (int i = 0; i < c->count; i++) {
+        if (strcmp(c->entries[i].key, key) == 0) return &c->entries[i];
+    }
+    return NULL;
+}
+
+// Caller holds the lock.
+static void dir_cache_remove(DirCache *c, DirCacheEntry *e) {
+    free(e->key);
+    free(e->data);
+    *e = c->entries[--c->count];
+}
+
+// Returns the slot for key, evicting the oldest idle entry when full.
+// Caller holds the lock.
+static DirCacheEntry *dir_cache_slot(DirCache *c, const char *key) {
+    DirCacheEntry *e = dir_cache_find(c, key);
+    if (e) return e;
+
+    if (c->count == DIR_CACHE_MAX) {
+        DirCacheEntry *oldest = NULL;
+        for (int i = 0; i < c->count; i++) {
+            DirCacheEntry *cand = &c->entries[i];
+            if (cand->fetching) continue;
+            if (!oldest || cand->fetched_ms < oldest->fetched_ms) oldest = cand;
+        }
+        if (!oldest) return NULL;
+        dir_cache_remove(c, oldest);
+    }
+
+    char *copy = strdup(key);
+    if (!copy) return NULL;
+    e = &c->entries[c->count++];
+    memset(e, 0, sizeof(*e));
+    e->key = copy;
+    return e;
+}
+
+// Caller holds the lock; takes ownership of data.
+static void dir_cache_store(DirCache *c, const char *key, char *data, size_t len) {
+    DirCacheEntry *e = dir_cache_slot(c, key);
+    if (!e) {
+        free(data);
+        return;
+    }
+    free(e->data);
+    e->data = data;
+    e->len = len;
+    e->fetched_ms = now_ms();
+}
+
+static void dir_prefetch_job_free(DirPrefetchJob *job) {
+    free(job->key);
+    free(job->cmd);
+    job->key = NULL;
+    job->cmd = NULL;
+}
+
+static void *dir_prefetch_main(void *arg) {
+    DirCache *c = (DirCache*)arg;
+
+    pthread_mutex_lock(&c->lock);
+    for (;;) {
+        while (!c->shutdown && c->queued == 0) pthread_cond_wait(&c->cv, &c->lock);
+        if (c->shutdown) break;
+
+        // Newest request first: it is the one the user is looking at.
+        DirPrefetchJob job = c->queue[--c->queued];
+        unsigned gen = c->gen;
+        DirCacheEntry *e = dir_cache_slot(c, job.key);
+        if (!e) {
+            dir_prefetch_job_free(&job);
+            continue;
+        }
+        e->fetching = 1;
+        c->busy = 1;
+        pthread_mutex_unlock(&c->lock);
+
+        DirCacheEntry got;
+        char err[256];
+        int ok = ssh_fetch_listing(job.cmd, &got, err, sizeof(err));
+
+        pthread_mutex_lock(&c->lock);
+        c->busy = 0;
+        e = dir_cache_find(c, job.key);
+        if (e) e->fetching = 0;
+        if (ok && gen == c->gen) {
+            dir_cache_store(c, job.key, got.data, got.len);
+        } else {
+            free(got.data);
+            // Don't leave an empty placeholder that looks like a listing.
+            if (e && !e->data) dir_cache_remove(c, e);
+        }
+        dir_prefetch_job_free(&job);
+        pthread_cond_broadcast(&c->cv);
+    }
+    pthread_mutex_unlock(&c->lock);
+    return NULL;
+}
+
+// Queues a background listing of path unless it is cached, in flight or
+// already queued.
+static void dir_prefetch(FuzzyState *st, const char *path) {
+    DirCache *c = dir_cache_get(st);
+    if (!c) return;
+    char *key = dir_cache_key(st, path, st->show_hidden);
+    if (!key) return;
+
+    char cmd[4096];
+    if (!ssh_listing_command(st, path, st->show_hidden, cmd, sizeof(cmd))) {
+        free(key);
+        return;
+    }
+
+    pthread_mutex_lock(&c->lock);
+
+    int skip = 0;
+    DirCacheEntry *e = dir_cache_find(c, key);
+    if (e && (e->fetching || (e->data && now_ms() - e->fetched_ms < DIR_CACHE_TTL_MS))) skip = 1;
+    for (int i = 0; !skip && i < c->queued; i++) {
+        if (strcmp(c->queue[i].key, key) == 0) skip = 1;
+    }
+
+    if (!skip && !c->active) {
+        if (pthread_create(&c->thread, NULL, dir_prefetch_main, c) == 0) c->active = 1;
+        else skip = 1;
+    }
+
+    if (!skip) {
+        if (c->queued == DIR_PREFETCH_QUEUE) {
+            dir_prefetch_job_free(&c->queue[0]);
+            memmove(c->queue, c->queue + 1, (size_t)(c->queued - 1) * sizeof(c->queue[0]));
+            c->queued--;
+        }
+        char *cmd_copy = strdup(cmd);
+        if (cmd_copy) {
+            c->queue[c->queued].key = key;
+            c->queue[c->queued].cmd = cmd_copy;
+            c->queued++;
+            key = NULL;
+            pthread_cond_signal(&c->cv);
+        }
+    }
+
+    pthread_mutex_unlock(&c->lock);
+    free(key);
+}
+
+// Ctrl+R: forget every listing, including any the worker is fetching now.
+static void dir_cache_invalidate(FuzzyState *st) {
+    DirCache *c = st->dir_cache;
+    if (!c) return;
+
+    pthread_mutex_lock(&c->lock);
+    c->gen++;
+    for (int i = c->count - 1; i >= 0; i--) {
+        if (!c->entries[i].fetching) dir_cache_remove(c, &c->entries[i]);
+    }
+    while (c->queued > 0) dir_prefetch_job_free(&c->queue[--c->queued]);
+    pthread_mutex_unlock(&c->lock);
+}
+
+static void dir_cache_shutdown(FuzzyState *st) {
+    DirCache *c = st->dir_cache;
+    if (!c) return;
+    st->dir_cache = NULL;
+
+    pthread_mutex_lock(&c->lock);
+    c->shutdown = 1;
+    int busy = c->busy;
+    pthread_cond_broadcast(&c->cv);
+    pthread_mutex_unlock(&c->lock);
+
+    if (c->active) {
+        // A fetch can sit in ssh's connect timeout; don't hold up exit for
+        // it. The worker still writes the cache when it returns, so the
+        // cache is left to it.
+        if (busy) {
+            pthread_detach(c->thread);
+            return;
+        }
+        pthread_join(c->thread, NULL);
+        c->active = 0;
+    }
+
+    while (c->queued > 0) dir_prefetch_job_free(&c->queue[--c->queued]);
+    while (c->count > 0) dir_cache_remove(c, &c->entries[c->count - 1]);
+    pthread_mutex_destroy(&c->lock);
+    pthread_cond_destroy(&c->cv);
+    free(c);
+}
+
+// Parent of a remote path, or 0 at the root.
+static int remote_parent(const char *path, char *out, size_t size) {
+    const char *last_slash = strrchr(path, '/');
+    if (!last_slash || strcmp(path, "/") == 0) return 0;
+    if (last_slash == path) {
+        snprintf(out, size, "/");
+    } else {
+        snprintf(out, size, "%.*s", (int)(last_slash - path), path);
+    }
+    return 1;
+}
+
+// Child directory named by a listing entry ("name/"), or 0 if it isn't one.
+static int remote_child(const char *dir, const char *entry, char *out, size_t size) {
+    size_t len = strlen(entry);
+    if (len < 2 || entry[len - 1] != '/' || strcmp(entry, "../") == 0) return 0;
+
+    const char *sep = (strcmp(dir, "/") == 0) ? "" : "/";
+    int n = snprintf(out, size, "%s%s%.*s", dir, sep, (int)(len - 1), entry);
+    return n > 0 && n < (int)size;
+}
+
+// Called once per main loop pass. When the selection has rested on the same
+// entry for DIR_PREFETCH_DELAY_MS, queue the parent and, for a directory,
+// the entry. Returns how long the loop may sleep before the next check.
+static int dir_prefetch_tick(FuzzyState *st) {
+    if (!st->ssh_mode || !st->is_directory_mode) return -1;
+
+    DirCache *c = dir_cache_get(st);
+    if (!c) return -1;
+    const char *entry = "";
+    if (st->selected >= 0 && st->selected < st->match_count) {
+        entry = line_plain(st, st->match_indices[st->selected]);
+    }
+
+    char hover[sizeof(c->hover)];
+    snprintf(hover, sizeof(hover), "%d\n%s\n%s", st->show_hidden, st->current_dir, entry);
+    long now = now_ms();
+    if (strcmp(hover, c->hover) != 0) {
+        memcpy(c->hover, hover, sizeof(hover));
+        c->hover_ms = now;
+        c->hover_done = 0;
+    }
+    if (c->hover_done) return -1;
+
+    long left = c->hover_ms + DIR_PREFETCH_DELAY_MS - now;
+    if (left > 0) return (int)left;
+    c->hover_done = 1;
+
+    char path[PATH_MAX];
+    if (remote_parent(st->current_dir, path, sizeof(path))) dir_prefetch(st, path);
+    if (remote_child(st->current_dir, entry, path, sizeof(path))) dir_prefetch(st, path);
+    return -1;
+}
+
+static void load_ssh_directory(FuzzyState *st, const char *path) {
+    if (!path || !path[0]) {
+        fprintf(stderr, "Invalid remote path\n");
+        return;
+    }
+
+    clear_lines(st);
+
+    DirCache *c = dir_cache_get(st);
+    char *key = c ? dir_cache_key(st, path, st->show_hidden) : NULL;
+    if (!key) {
+        fprintf(stderr, "Out of memory\n");
+        return;
+    }
+
+    // Serve from the cache when we can. If the worker is fetching this very
+    // directory, wait for it rather than asking twice; if it is only queued,
+    // take it over.
+    char *data = NULL;
+    size_t len = 0;
+    pthread_mutex_lock(&c->lock);
+    DirCacheEntry *e;
+    while ((e = dir_cache_find(c, key)) != NULL && e->fetching) {
+        pthread_cond_wait(&c->cv, &c->lock);
+    }
+    if (e && e->data && now_ms() - e->fetched_ms < DIR_CACHE_TTL_MS) {
+        data = (char*)malloc(e->len ? e->len : 1);
+        if (data) {
+            memcpy(data, e->data, e->len);
+            len = e->len;
+        }
+    }
+    for (int i = 0; i < c->queued; i++) {
+        if (strcmp(c->queue[i].key, key) == 0) {
+            dir_prefetch_job_free(&c->queue[i]);
+            c->queue[i] = c->queue[--c->queued];
+            break;
+        }
+    }
+    unsigned gen = c->gen;
+    pthread_mutex_unlock(&c->lock);
+
+    if (!data) {
+        char cmd[4096];
+        if (!ssh_listing_command(st, path, st->show_hidden, cmd, sizeof(cmd))) {
+            free(key);
+            return;
+        }
+
+        DirCacheEntry got;
+        char err[256];
+        if (!ssh_fetch_listing(cmd, &got, err, sizeof(err))) {
+            if (strcmp(err, "failed to cd") == 0) {
+                fprintf(stderr, "SSH: failed to cd into: %s\n", st->current_dir);
+            } else {
+                fprintf(stderr, "%s\n", err);
+            }
+            free(key);
+            return;
+        }
+        data = got.data;
+        len = got.len;
+
+        if (data) {
+            char *copy = (char*)malloc(len ? len : 1);
+            pthread_mutex_lock(&c->lock);
+            if (copy && gen == c->gen) {
+                memcpy(copy, data, len);
+                dir_cache_store(c, key, copy, len);
+            } else {
+                free(copy);
+            }
+            pthread_mutex_unlock(&c->lock);
+        }
+    }
+
+    for (size_t off = 0; off < len; ) {
+        add_line(st, data + off);
+        off += strlen(data + off) + 1;
+    }
+
+    free(data);
+    free(key);
+}
+static FILE *open_ssh_file(FuzzyState *st, const char *path) {
+    if (!path || !path[0]) return NULL;
+
+    char user[256], host[256], remote_path[PATH_MAX];
+
+    if (!parse_ssh_path(path, user, sizeof(user), host, sizeof(host),
+                        remote_path, sizeof(remote_path))) {
+        return NULL;
+    }
+
+    strncpy(st->ssh_host, host, sizeof(st->ssh_host) - 1);
+    st->ssh_host[sizeof(st->ssh_host) - 1] = '\0';
+    strncpy(st->ssh_user, user, sizeof(st->ssh_user) - 1);
+    st->ssh_user[sizeof(st->ssh_user) - 1] = '\0';
+
+    char *qremote = quote_dash_safe(remote_path);
+    if (!qremote) {
+        fprintf(stderr, "Out of memory\n");
+        return NULL;
+    }
+
+    char command[PATH_MAX + 64];
+    int written = snprintf(command, sizeof(command), "cat %s", qremote);
+    free(qremote);
+
+    if (written < 0 || written >= (int)sizeof(command)) {
+        fprintf(stderr, "Remote path too long\n");
+        return NULL;
+    }
+
+    FILE *fp = ssh_popen(st, user, host, command);
+    if (!fp) {
+        fprintf(stderr, "Failed to execute SSH command for '%s'\n", path);
+        return NULL;
+    }
+
+    return fp;
+}
+
+static int load_ssh_file(FuzzyState *st, const char *path) {
+    FILE *fp = open_ssh_file(st, path);
+    if (!fp) return 0;
+
+    load_stream(st, fp);
+
+    int status = pclose(fp);
+    if (status != 0) {
+        fprintf(stderr, "SSH command failed for '%s'\n", path);
+        return 0;
+    }
+
+    return 1;
+}
+
+// Reader side of the wakeup: tells a waiting UI that lines were published.
+// The fence pairs with the one in ingest_wait so that either the UI sees the
+// new count or the reader sees it armed.
+static void ingest_notify(Ingest *in) {
+    if (!in->wake_ready) return;
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (!__atomic_load_n(&in->wake_armed, __ATOMIC_RELAXED)) return;
+    if (!__atomic_exchange_n(&in->wake_armed, 0, __ATOMIC_SEQ_CST)) return;
+
+    char b = 1;
+    ssize_t w = write(in->wake[1], &b, 1);
+    (void)w;
+}
+
+static void ingest_notify_hook(void *arg) {
+    ingest_notify((Ingest*)arg);
+}
+
+static void ingest_stream(FuzzyState *st, FILE *fp) {
+    Ingest *in = &st->ingest;
+    uint64_t base = in->bytes;
+
+    LineReader r;
+    if (!line_reader_open(&r, fp)) return;
+    // Lines are published one by one; the UI only needs a nudge when the
+    // reader is about to wait for more input.
+    r.before_read = ingest_notify_hook;
+    r.before_read_arg = in;
+
+    char *line;
+    size_t len;
+    while ((line = line_reader_next(&r, &len)) != NULL) {
+        if (len == 0) continue;
+        if (!line_store_add(&st->store, line, len)) continue;
+
+        __atomic_store_n(&in->bytes, base + r.bytes, __ATOMIC_RELAXED);
+        __atomic_store_n(&in->published, st->store.count, __ATOMIC_RELEASE);
+    }
+
+    __atomic_store_n(&in->bytes, base + r.bytes, __ATOMIC_RELAXED);
+    line_reader_close(&r);
+}
+
+typedef struct {
+    char *path;      // relative to the walk root, "" for the root itself
+    int depth;
+} WalkDir;
+
+typedef struct {
+    pthread_mutex_t lock;
+    WalkDir *items;  // live range is [head, tail)
+    int head;
+    int tail;
+    int cap;
+} WalkDeque;
+
+typedef struct {
+    pthread_mutex_t lock;
+    uint64_t *slots; // (dev, ino + 1) pairs; ino + 1 == 0 marks an empty slot
+    size_t cap;
+    size_t count;
+} WalkSeen;
+
+typedef struct {
+    FuzzyState *st;
+    WalkDeque *deques;
+    int nthreads;
+    int pending;     // directories queued or being read
+    pthread_mutex_t store_lock;
+
+    // Workers with nothing to take wait here until a push bumps `pushed`
+    // or the last directory is done.
+    pthread_mutex_t idle_lock;
+    pthread_cond_t idle_cv;
+    int idle;
+    unsigned pushed;
+    WalkSeen seen[WALK_SEEN_SHARDS];
+} Walk;
+
+typedef struct {
+    Walk *w;
+    int self;
+    char *buf;       // paths waiting to be added to the store, NUL-separated
+    size_t len;
+    size_t cap;
+    long flushed_ms;
+} WalkWorker;
+
+// Records a directory by identity; returns 0 if it was already entered.
+static int walk_mark_seen(Walk *w, dev_t dev, ino_t ino) {
+    uint64_t d = (uint64_t)dev, i = (uint64_t)ino + 1;
+    uint64_t h = (d * 0x9E3779B97F4A7C15ULL) ^ (i * 0xC2B2AE3D27D4EB4FULL);
+    WalkSeen *s = &w->seen[h % WALK_SEEN_SHARDS];
+    h /= WALK_SEEN_SHARDS;
+
+    pthread_mutex_lock(&s->lock);
+    if ((s->count + 1) * 2 > s->cap) {
+        size_t cap = s->cap ? s->cap * 2 : 256;
+        uint64_t *slots = (uint64_t*)calloc(cap * 2, sizeof(uint64_t));
+        if (!slots) {
+            pthread_mutex_unlock(&s->lock);
+            return 1;
+        }
+        for (size_t k = 0; k < s->cap; k++) {
+            uint64_t od = s->slots[2 * k], oi = s->slots[2 * k + 1];
+            if (!oi) continue;
+            uint64_t oh = ((od * 0x9E3779B97F4A7C15ULL) ^ (oi * 0xC2B2AE3D27D4EB4FULL)) / WALK_SEEN_SHARDS;
+            size_t j = oh & (cap - 1);
+            while (slots[2 * j + 1]) j = (j + 1) & (cap - 1);
+            slots[2 * j] = od;
+            slots[2 * j + 1] = oi;
+        }
+        free(s->slots);
+        s->slots = slots;
+        s->cap = cap;
+    }
+
+    size_t j = h & (s->cap - 1);
+    while (s->slots[2 * j + 1]) {
+        if (s->slots[2 * j] == d && s->slots[2 * j + 1] == i) {
+            pthread_mutex_unlock(&s->lock);
+            return 0;
+        }
+        j = (j + 1) & (s->cap - 1);
+    }
+    s->slots[2 * j] = d;
+    s->slots[2 * j + 1] = i;
+    s->count++;
+    pthread_mutex_unlock(&s->lock);
+    return 1;
+}
+
+// Finishes one pending directory; the last one releases the idle workers.
+static void walk_done(Walk *w) {
+    if (__atomic_sub_fetch(&w->pending, 1, __ATOMIC_ACQ_REL) != 0) return;
+    pthread_mutex_lock(&w->idle_lock);
+    pthread_cond_broadcast(&w->idle_cv);
+    pthread_mutex_unlock(&w->idle_lock);
+}
+
+static void walk_push(Walk *w, int self, char *path, int depth) {
+    WalkDeque *q = &w->deques[self];
+    __atomic_add_fetch(&w->pending, 1, __ATOMIC_RELAXED);
+
+    pthread_mutex_lock(&q->lock);
+    if (q->tail == q->cap) {
+        if (q->head > 0) {
+            memmove(q->items, q->items + q->head, (size_t)(q->tail - q->head) * sizeof(WalkDir));
+            q->tail -= q->head;
+            q->head = 0;
+        }
+        if (q->tail == q->cap) {
+            int cap = q->cap ? q->cap * 2 : 64;
+            WalkDir *items = (WalkDir*)realloc(q->items, (size_t)cap * sizeof(WalkDir));
+            if (!items) {
+                pthread_mutex_unlock(&q->lock);
+                free(path);
+                walk_done(w);
+                return;
+            }
+            q->items = items;
+            q->cap = cap;
+        }
+    }
+    q->items[q->tail].path = path;
+    q->items[q->tail].depth = depth;
+    q->tail++;
+    pthread_mutex_unlock(&q->lock);
+
+    // Pairs with the check in walk_park: either it sees the bump, or the
+    // parked worker is counted here and gets the signal.
+    __atomic_add_fetch(&w->pushed, 1, __ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&w->idle, __ATOMIC_SEQ_CST) > 0) {
+        pthread_mutex_lock(&w->idle_lock);
+        pthread_cond_signal(&w->idle_cv);
+        pthread_mutex_unlock(&w->idle_lock);
+    }
+}
+
+// Sleeps until something was pushed since `seen` or the walk is over.
+// Returns 0 once nothing is pending.
+static int walk_park(Walk *w, unsigned seen) {
+    pthread_mutex_lock(&w->idle_lock);
+    __atomic_add_fetch(&w->idle, 1, __ATOMIC_SEQ_CST);
+    while (__atomic_load_n(&w->pushed, __ATOMIC_SEQ_CST) == seen &&
+           __atomic_load_n(&w->pending, __ATOMIC_ACQUIRE) > 0) {
+        pthread_cond_wait(&w->idle_cv, &w->idle_lock);
+    }
+    __atomic_sub_fetch(&w->idle, 1, __ATOMIC_SEQ_CST);
+    pthread_mutex_unlock(&w->idle_lock);
+    return __atomic_load_n(&w->pending, __ATOMIC_ACQUIRE) > 0;
+}
+
+// The owner takes its newest directory (depth first, warm caches); thieves
+// take the oldest, which is the shallowest and usually the largest subtree.
+static int walk_take(Walk *w, int from, int steal, WalkDir *out) {
+    WalkDeque *q = &w->deques[from];
+    pthread_mutex_lock(&q->lock);
+    int ok = q->tail > q->head;
+    if (ok) *out = steal ? q->items[q->head++] : q->items[--q->tail];
+    pthread_mutex_unlock(&q->lock);
+    return ok;
+}
+
+// Adds a worker's batch of NUL-separated lines to the store and publishes
+// them. Workers batch so the lock is taken once per batch, not per line.
+static void ingest_append(FuzzyState *st, pthread_mutex_t *lock, const char *buf, size_t size) {
+    Ingest *in = &st->ingest;
+
+    pthread_mutex_lock(lock);
+    for (size_t off = 0; off < size; ) {
+        size_t len = strlen(buf + off);
+        line_store_add(&st->store, buf + off, len);
+        off += len + 1;
+    }
+    __atomic_add_fetch(&in->bytes, (uint64_t)size, __ATOMIC_RELAXED);
+    __atomic_store_n(&in->published, st->store.count, __ATOMIC_RELEASE);
+    pthread_mutex_unlock(lock);
+    ingest_notify(in);
+}
+
+static void walk_flush(WalkWorker *ww) {
+    if (ww->len == 0) return;
+    ingest_append(ww->w->st, &ww->w->store_lock, ww->buf, ww->len);
+    ww->len = 0;
+    ww->flushed_ms = now_ms();
+}
+
+static void walk_emit(WalkWorker *ww, const char *dir, const char *name) {
+    const WalkConfig *cfg = &ww->w->st->walk;
+    size_t plen = strlen(cfg->prefix), dlen = strlen(dir), nlen = strlen(name);
+    size_t need = plen + dlen + 1 + nlen + 1;
+
+    if (ww->len + need > ww->cap) {
+        size_t cap = ww->cap ? ww->cap : WALK_FLUSH_BYTES;
+        while (cap < ww->len + need) cap *= 2;
+        char *buf = (char*)realloc(ww->buf, cap);
+        if (!buf) return;
+        ww->buf = buf;
+        ww->cap = cap;
+    }
+
+    char *p = ww->buf + ww->len;
+    memcpy(p, cfg->prefix, plen);
+    p += plen;
+    if (dlen) {
+        memcpy(p, dir, dlen);
+        p += dlen;
+        *p++ = '/';
+    }
+    memcpy(p, name, nlen + 1);
+    ww->len = (size_t)(p + nlen + 1 - ww->buf);
+}
+
+static int walk_excluded(const FuzzyState *st, const char *name) {
+    const WalkConfig *cfg = &st->walk;
+    if (name[0] == '.' && !st->show_hidden) return 1;
+    for (int i = 0; i < cfg->exclude_count; i++) {
+        if (fnmatch(cfg->excludes[i], name, 0) == 0) return 1;
+    }
+    return 0;
+}
+
+static void walk_read_dir(WalkWorker *ww, const WalkDir *d) {
+    Walk *w = ww->w;
+    const WalkConfig *cfg = &w->st->walk;
+
+    int fd = openat(cfg->fd, d->path[0] ? d->path : ".", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd < 0) return;
+
+    struct stat sb;
+    if (fstat(fd, &sb) != 0 || !walk_mark_seen(w, sb.st_dev, sb.st_ino)) {
+        close(fd);
+        return;
+    }
+
+    DIR *dir = fdopendir(fd);
+    if (!dir) {
+        close(fd);
+        return;
+    }
+
+    int descend = cfg->max_depth <= 0 || d->depth + 1 < cfg->max_depth;
+    size_t dlen = strlen(d->path);
+
+    struct dirent *e;
+    while ((e = readdir(dir)) != NULL) {
+        const char *name = e->d_name;
+        if (name[0] == '.' && (name[1] == '\0' || (name[1] == '.' && name[2] == '\0'))) continue;
+        if (walk_excluded(w->st, name)) continue;
+
+        // Symlinks are followed; a dangling one is listed like a file.
+        int is_dir = e->d_type == DT_DIR;
+        if (e->d_type == DT_UNKNOWN || e->d_type == DT_LNK) {
+            struct stat esb;
+            is_dir = fstatat(fd, name, &esb, 0) == 0 && S_ISDIR(esb.st_mode);
+        }
+
+        if (!is_dir) {
+            walk_emit(ww, d->path, name);
+            continue;
+        }
+        if (!descend) continue;
+
+        size_t nlen = strlen(name);
+        char *child = (char*)malloc(dlen + 1 + nlen + 1);
+        if (!child) continue;
+        if (dlen) {
+            memcpy(child, d->path, dlen);
+            child[dlen] = '/';
+            memcpy(child + dlen + 1, name, nlen + 1);
+        } else {
+            memcpy(child, name, nlen + 1);
+        }
+        walk_push(w, ww->self, child, d->depth + 1);
+    }
+    closedir(dir);
+
+    // Small batches early so the first results show up right away.
+    if (ww->len >= WALK_FLUSH_BYTES || now_ms() - ww->flushed_ms >= WALK_FLUSH_MS) {
+        walk_flush(ww);
+    }
+}
+
+static void *walk_worker_main(void *arg) {
+    WalkWorker *ww = (WalkWorker*)arg;
+    Walk *w = ww->w;
+
+    for (;;) {
+        unsigned seen = __atomic_load_n(&w->pushed, __ATOMIC_SEQ_CST);
+        WalkDir d;
+        int got = walk_take(w, ww->self, 0, &d);
+        for (int k = 1; !got && k < w->nthreads; k++) {
+            got = walk_take(w, (ww->self + k) % w->nthreads, 1, &d);
+        }
+
+        if (!got) {
+            if (!walk_park(w, seen)) break;
+            continue;
+        }
 
-    return 1;
+        walk_read_dir(ww, &d);
+        free(d.path);
+        walk_done(w);
+    }
+
+    walk_flush(ww);
+    return NULL;
 }
 
-static FILE *ssh_popen(const char *user, const char *host, const char *command) {
-    if (!host || !host[0] || !command || !command[0]) {
-        return NULL;
+// Runs on the ingest thread, which doubles as worker 0.
+static void ingest_walk(FuzzyState *st) {
+    int n = st->threads;
+    if (n <= 0) {
+        long online = sysconf(_SC_NPROCESSORS_ONLN);
+        n = online > 0 ? (int)online : 1;
     }
+    if (n > WALK_MAX_THREADS) n = WALK_MAX_THREADS;
+    if (n < 1) n = 1;
+
+    Walk w;
+    memset(&w, 0, sizeof(w));
+    w.st = st;
+    w.nthreads = n;
+    pthread_mutex_init(&w.store_lock, NULL);
+    pthread_mutex_init(&w.idle_lock, NULL);
+    pthread_cond_init(&w.idle_cv, NULL);
+    for (int i = 0; i < WALK_SEEN_SHARDS; i++) pthread_mutex_init(&w.seen[i].lock, NULL);
+
+    w.deques = (WalkDeque*)calloc((size_t)n, sizeof(WalkDeque));
+    WalkWorker *workers = (WalkWorker*)calloc((size_t)n, sizeof(WalkWorker));
+    pthread_t *threads = (pthread_t*)calloc((size_t)n, sizeof(pthread_t));
+    char *root = strdup("");
+    if (w.deques && workers && threads && root) {
+        for (int i = 0; i < n; i++) pthread_mutex_init(&w.deques[i].lock, NULL);
+        walk_push(&w, 0, root, 0);
+        root = NULL;
+
+        long started = now_ms();
+        int spawned = 1;
+        for (int i = 0; i < n; i++) {
+            workers[i].w = &w;
+            workers[i].self = i;
+            workers[i].flushed_ms = started;
+        }
+        for (int i = 1; i < n; i++) {
+            if (pthread_create(&threads[i], NULL, walk_worker_main, &workers[i]) != 0) break;
+            spawned++;
+        }
+        walk_worker_main(&workers[0]);
+        for (int i = 1; i < spawned; i++) pthread_join(threads[i], NULL);
 
-    char *qcmd = sh_sq(command);
-    if (!qcmd) return NULL;
+        for (int i = 0; i < n; i++) {
+            free(workers[i].buf);
+            free(w.deques[i].items);
+            pthread_mutex_destroy(&w.deques[i].lock);
+        }
+    }
 
-    char ssh_cmd[4096];
-    int written;
+    free(root);
+    free(threads);
+    free(workers);
+    free(w.deques);
+    for (int i = 0; i < WALK_SEEN_SHARDS; i++) {
+        free(w.seen[i].slots);
+        pthread_mutex_destroy(&w.seen[i].lock);
+    }
+    pthread_mutex_destroy(&w.store_lock);
+    pthread_mutex_destroy(&w.idle_lock);
+    pthread_cond_destroy(&w.idle_cv);
+}
 
-    if (user && user[0]) {
-        written = snprintf(ssh_cmd, sizeof(ssh_cmd),
-                           "ssh -o ConnectTimeout=10 -o BatchMode=yes %s@%s %s 2>&1",
-                           user, host, qcmd);
-    } else {
-        written = snprintf(ssh_cmd, sizeof(ssh_cmd),
-                           "ssh -o ConnectTimeout=10 -o BatchMode=yes %s %s 2>&1",
-                           host, qcmd);
+// Opens the -R root up front so a bad path is reported before the UI starts.
+static int walk_open_root(FuzzyState *st) {
+    WalkConfig *cfg = &st->walk;
+
+    cfg->fd = open(cfg->root, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (cfg->fd < 0) {
+        fprintf(stderr, "nfzf: cannot walk '%s': %s\n", cfg->root, strerror(errno));
+        return 0;
     }
 
-    free(qcmd);
+    // Paths under "." are listed bare, the way find prints them minus "./".
+    size_t len = strlen(cfg->root);
+    while (len > 1 && cfg->root[len - 1] == '/') len--;
+    if (len == 1 && cfg->root[0] == '.') len = 0;
 
-    if (written < 0 || written >= (int)sizeof(ssh_cmd)) {
-        fprintf(stderr, "SSH command too long\n");
-        return NULL;
+    cfg->prefix = (char*)malloc(len + 2);
+    if (!cfg->prefix) {
+        close(cfg->fd);
+        fprintf(stderr, "Error: out of memory\n");
+        return 0;
     }
+    if (len == 1 && cfg->root[0] == '/') snprintf(cfg->prefix, 2, "/");
+    else if (len > 0) snprintf(cfg->prefix, len + 2, "%.*s/", (int)len, cfg->root);
+    else cfg->prefix[0] = '\0';
+    return 1;
+}
 
-    return popen(ssh_cmd, "r");
+typedef struct {
+    FuzzyState *st;
+    int next;        // next file to claim
+    pthread_mutex_t store_lock;
+} Grep;
+
+typedef struct {
+    Grep *g;
+    char *buf;       // hits waiting to be added to the store, NUL-separated
+    size_t len;
+    size_t cap;
+    long flushed_ms;
+
+    regex_t regex;
+    int regex_state; // 0 not compiled, 1 ready, -1 failed
+    char *line;      // NUL-terminated copy of a line, for regexec
+    size_t line_cap;
+    AlignScratch align;
+} GrepWorker;
+
+static inline int grep_cancelled(const GrepConfig *cfg) {
+    return __atomic_load_n(&cfg->cancel, __ATOMIC_RELAXED);
 }
 
-static void load_ssh_directory(FuzzyState *st, const char *path) {
-    if (!path || !path[0]) {
-        fprintf(stderr, "Invalid remote path\n");
-        return;
-    }
+static void grep_flush(GrepWorker *gw) {
+    if (gw->len == 0) return;
+    ingest_append(gw->g->st, &gw->g->store_lock, gw->buf, gw->len);
+    gw->len = 0;
+    gw->flushed_ms = now_ms();
+}
 
-    clear_lines(st);
+static void grep_emit(GrepWorker *gw, const char *path, long line_no, const char *text, size_t len) {
+    GrepConfig *cfg = &gw->g->st->grep;
 
-    char *qpath = quote_dash_safe(path);
-    if (!qpath) {
-        fprintf(stderr, "Out of memory\n");
+    // --filter prints every hit, the way grep would.
+    if (__atomic_add_fetch(&cfg->hits, 1, __ATOMIC_RELAXED) > GREP_MAX_HITS && !gw->g->st->filter_mode) {
+        __atomic_store_n(&cfg->truncated, 1, __ATOMIC_RELAXED);
+        __atomic_store_n(&cfg->cancel, 1, __ATOMIC_RELAXED);
         return;
     }
 
-    // If cd fails, emit a sentinel and exit nonzero so we don't "ls ~" by accident.
-    char ls_cmd[2048];
-    int written;
-
-    if (st->show_hidden) {
-        written = snprintf(ls_cmd, sizeof(ls_cmd),
-            "cd %s 2>/dev/null || { printf '__NBL_CD_FAIL__\\n'; exit 42; }; "
-            "ls -Ap1 --color=never 2>/dev/null || ls -Ap1 2>/dev/null",
-            qpath
-        );
-    } else {
-        written = snprintf(ls_cmd, sizeof(ls_cmd),
-            "cd %s 2>/dev/null || { printf '__NBL_CD_FAIL__\\n'; exit 42; }; "
-            "ls -p1 --color=never 2>/dev/null || ls -p1 2>/dev/null",
-            qpath
-        );
+    // The store cuts lines at a NUL anyway.
+    const char *nul = (const char*)memchr(text, '\0', len);
+    if (nul) len = (size_t)(nul - text);
+
+    char label[32];
+    int llen = snprintf(label, sizeof(label), ":%ld:", line_no);
+    size_t plen = strlen(path);
+    size_t need = plen + (size_t)llen + len + 1;
+
+    if (gw->len + need > gw->cap) {
+        size_t cap = gw->cap ? gw->cap : GREP_FLUSH_BYTES;
+        while (cap < gw->len + need) cap *= 2;
+        char *buf = (char*)realloc(gw->buf, cap);
+        if (!buf) return;
+        gw->buf = buf;
+        gw->cap = cap;
     }
 
-    free(qpath);
+    char *p = gw->buf + gw->len;
+    memcpy(p, path, plen);
+    memcpy(p + plen, label, (size_t)llen);
+    memcpy(p + plen + llen, text, len);
+    p[need - 1] = '\0';
+    gw->len += need;
 
-    if (written < 0 || written >= (int)sizeof(ls_cmd)) {
-        fprintf(stderr, "Directory path too long\n");
-        return;
+    if (gw->len >= GREP_FLUSH_BYTES || now_ms() - gw->flushed_ms >= GREP_FLUSH_MS) grep_flush(gw);
+}
+
+static long count_newlines(const char *p, const char *end) {
+    long n = 0;
+    while (p < end && (p = (const char*)memchr(p, '\n', (size_t)(end - p))) != NULL) {
+        n++;
+        p++;
     }
+    return n;
+}
 
-    FILE *fp = ssh_popen(st->ssh_user, st->ssh_host, ls_cmd);
-    if (!fp) {
-        fprintf(stderr, "Failed to connect to %s@%s\n",
-                st->ssh_user[0] ? st->ssh_user : "ssh", st->ssh_host);
-        return;
+// Accepts exactly the lines score_line would, so no hit is materialized only
+// to be dropped by the ranking.
+static int grep_line_matches(GrepWorker *gw, const char *line, size_t len) {
+    const GrepConfig *cfg = &gw->g->st->grep;
+    if (len > INT_MAX) return 0;
+
+    switch (cfg->mode) {
+        case MATCH_EXACT:
+            return exact_find(cfg->query, cfg->query_len, line, (int)len, cfg->case_sensitive) >= 0;
+
+        case MATCH_REGEX:
+            if (gw->regex_state <= 0) return 0;
+            if (len + 1 > gw->line_cap) {
+                char *copy = (char*)realloc(gw->line, len + 1);
+                if (!copy) return 0;
+                gw->line = copy;
+                gw->line_cap = len + 1;
+            }
+            memcpy(gw->line, line, len);
+            gw->line[len] = '\0';
+            return regexec(&gw->regex, gw->line, 0, NULL, 0) == 0;
+
+        case MATCH_FUZZY:
+        default:
+            if (cfg->algo == ALGO_V2) {
+                return fuzzy_score_v2(cfg->query, cfg->query_len, line, (int)len,
+                                      cfg->case_sensitive, &gw->align, NULL) >= 0;
+            }
+            return fuzzy_score(cfg->query, cfg->query_len, line, (int)len,
+                               cfg->case_sensitive, NULL) >= 0;
     }
+}
 
-    char line[MAX_LINE_LEN];
-    while (fgets(line, sizeof(line), fp) && st->line_count < MAX_LINES) {
-        size_t len = strlen(line);
-        while (len > 0 && (line[len - 1] == '\n' || line[len - 1] == '\r')) {
-            line[--len] = '\0';
+// Searches one file's contents. Exact and fuzzy queries jump between
+// occurrences of the query's first byte, so lines without it are never
+// looked at; a regex is tried on every line.
+static void grep_buffer(GrepWorker *gw, const char *path, const char *buf, size_t size) {
+    const GrepConfig *cfg = &gw->g->st->grep;
+    if (memchr(buf, '\0', size < GREP_SNIFF_BYTES ? size : GREP_SNIFF_BYTES)) return;
+
+    const char *end = buf + size;
+    const char *p = buf;
+    const char *counted = buf;
+    const char *checked = buf;
+    long line_no = 1;
+
+    int fold = 0;
+    unsigned char first = fold_needle((unsigned char)cfg->query[0], cfg->case_sensitive, &fold);
+
+    while (p < end) {
+        if (p - checked >= GREP_CANCEL_BYTES) {
+            if (grep_cancelled(cfg)) return;
+            checked = p;
         }
-        if (len == 0) continue;
 
-        // Sentinel: cd failed -> don't lie by listing ~
-        if (strcmp(line, "__NBL_CD_FAIL__") == 0) {
-            fprintf(stderr, "SSH: failed to cd into: %s\n", st->current_dir);
-            pclose(fp);
-            clear_lines(st);
-            return;
+        const char *start = p;
+        if (cfg->mode != MATCH_REGEX) {
+            const char *hit = find_byte(p, end, first, fold);
+            if (!hit) return;
+            start = hit;
+            while (start > p && start[-1] != '\n') start--;
         }
 
-        if (strcmp(line, ".") == 0) continue;
+        const char *nl = (const char*)memchr(start, '\n', (size_t)(end - start));
+        const char *stop = nl ? nl : end;
+        size_t len = (size_t)(stop - start);
+        if (len > 0 && start[len - 1] == '\r') len--;
 
-        if (strncmp(line, "Permission denied", 17) == 0 ||
-            strncmp(line, "Connection refused", 18) == 0 ||
-            strncmp(line, "Host key verification failed", 28) == 0) {
-            fprintf(stderr, "SSH error: %s\n", line);
-            pclose(fp);
-            clear_lines(st);
-            return;
+        if (len > 0 && grep_line_matches(gw, start, len)) {
+            line_no += count_newlines(counted, start);
+            counted = start;
+            grep_emit(gw, path, line_no, start, len);
         }
+        p = stop + 1;
+    }
+}
 
-        // (keep your exec marking logic)
-        int is_dir = (len > 0 && line[len - 1] == '/');
-
-        if (!is_dir && strcmp(line, "..") != 0) {
-            char name[MAX_LINE_LEN];
-            strncpy(name, line, sizeof(name) - 1);
-            name[sizeof(name) - 1] = '\0';
-
-            size_t nlen = strlen(name);
-            if (nlen > 0 && name[nlen - 1] == '*') name[nlen - 1] = '\0';
-
-            char full[PATH_MAX];
-            const char *sep = (path[0] && path[strlen(path) - 1] == '/') ? "" : "/";
-            snprintf(full, sizeof(full), "%s%s%s", path, sep, name);
-
-            char *qfull = quote_dash_safe(full);
-            if (qfull) {
-                char stat_cmd[2048];
-                int stat_written = snprintf(stat_cmd, sizeof(stat_cmd),
-                                            "[ -x %s ] && echo x || echo n", qfull);
-                free(qfull);
-
-                if (stat_written > 0 && stat_written < (int)sizeof(stat_cmd)) {
-                    FILE *stat_fp = ssh_popen(st->ssh_user, st->ssh_host, stat_cmd);
-                    if (stat_fp) {
-                        char result[8] = {0};
-                        if (fgets(result, sizeof(result), stat_fp)) {
-                            if (result[0] == 'x') {
-                                len = strlen(line);
-                                if (len < MAX_LINE_LEN - 2) {
-                                    line[len] = '*';
-                                    line[len + 1] = '\0';
-                                }
-                            }
-                        }
-                        pclose(stat_fp);
-                    }
-                }
-            }
-        }
+// Searches argument i: a pipe from the copy read at startup, a regular file
+// by mapping it. O_NONBLOCK keeps the open from waiting on a path that has
+// since turned into a FIFO, so grep_stop never joins a search stuck there.
+static void grep_file(GrepWorker *gw, int i) {
+    const GrepConfig *cfg = &gw->g->st->grep;
+    const char *path = cfg->files[i];
 
-        add_line(st, line);
+    if (cfg->data[i]) {
+        grep_buffer(gw, path, cfg->data[i], cfg->data_len[i]);
+        return;
     }
 
-    int status = pclose(fp);
-    if (status != 0) {
-        // If cd failed we already handled it; otherwise keep this.
-        fprintf(stderr, "SSH command exited with status %d\n", WEXITSTATUS(status));
+    int fd = open(path, O_RDONLY | O_CLOEXEC | O_NONBLOCK);
+    if (fd < 0) return;
+
+    struct stat sb;
+    if (fstat(fd, &sb) == 0 && S_ISREG(sb.st_mode) && sb.st_size > 0) {
+        void *map = mmap(NULL, (size_t)sb.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (map != MAP_FAILED) {
+#if defined(MADV_SEQUENTIAL)
+            madvise(map, (size_t)sb.st_size, MADV_SEQUENTIAL);
+#endif
+            grep_buffer(gw, path, (const char*)map, (size_t)sb.st_size);
+            munmap(map, (size_t)sb.st_size);
+        }
     }
+    close(fd);
 }
-static int load_ssh_file(FuzzyState *st, const char *path) {
-    if (!path || !path[0]) return 0;
 
-    char user[256], host[256], remote_path[PATH_MAX];
+static void *grep_worker_main(void *arg) {
+    GrepWorker *gw = (GrepWorker*)arg;
+    Grep *g = gw->g;
+    GrepConfig *cfg = &g->st->grep;
 
-    if (!parse_ssh_path(path, user, sizeof(user), host, sizeof(host),
-                        remote_path, sizeof(remote_path))) {
-        return 0;
+    if (cfg->mode == MATCH_REGEX) {
+        int flags = REG_EXTENDED | REG_NOSUB;
+        if (!cfg->case_sensitive) flags |= REG_ICASE;
+        gw->regex_state = regcomp(&gw->regex, cfg->query, flags) == 0 ? 1 : -1;
+        if (gw->regex_state < 0) return NULL;
     }
 
-    strncpy(st->ssh_host, host, sizeof(st->ssh_host) - 1);
-    st->ssh_host[sizeof(st->ssh_host) - 1] = '\0';
-    strncpy(st->ssh_user, user, sizeof(st->ssh_user) - 1);
-    st->ssh_user[sizeof(st->ssh_user) - 1] = '\0';
+    for (;;) {
+        int i = __atomic_fetch_add(&g->next, 1, __ATOMIC_RELAXED);
+        if (i >= cfg->file_count || grep_cancelled(cfg)) break;
 
-    char *qremote = quote_dash_safe(remote_path);
-    if (!qremote) {
-        fprintf(stderr, "Out of memory\n");
-        return 0;
+        grep_file(gw, i);
+        __atomic_add_fetch(&cfg->files_done, 1, __ATOMIC_RELAXED);
+        if (now_ms() - gw->flushed_ms >= GREP_FLUSH_MS) grep_flush(gw);
     }
+    grep_flush(gw);
 
-    char command[PATH_MAX + 64];
-    int written = snprintf(command, sizeof(command), "cat %s", qremote);
-    free(qremote);
+    if (gw->regex_state > 0) regfree(&gw->regex);
+    return NULL;
+}
 
-    if (written < 0 || written >= (int)sizeof(command)) {
-        fprintf(stderr, "Remote path too long\n");
-        return 0;
+static void ingest_grep(FuzzyState *st) {
+    GrepConfig *cfg = &st->grep;
+
+    int n = st->threads;
+    if (n <= 0) {
+        long online = sysconf(_SC_NPROCESSORS_ONLN);
+        n = online > 0 ? (int)online : 1;
     }
+    if (n > GREP_MAX_THREADS) n = GREP_MAX_THREADS;
+    if (n > cfg->file_count) n = cfg->file_count;
+    if (n < 1) n = 1;
+
+    Grep g;
+    memset(&g, 0, sizeof(g));
+    g.st = st;
+    pthread_mutex_init(&g.store_lock, NULL);
+
+    GrepWorker *workers = (GrepWorker*)calloc((size_t)n, sizeof(GrepWorker));
+    pthread_t *threads = (pthread_t*)calloc((size_t)n, sizeof(pthread_t));
+    if (workers && threads) {
+        long started = now_ms();
+        int spawned = 1;
+        for (int i = 0; i < n; i++) {
+            workers[i].g = &g;
+            workers[i].flushed_ms = started;
+        }
+        for (int i = 1; i < n; i++) {
+            if (pthread_create(&threads[i], NULL, grep_worker_main, &workers[i]) != 0) break;
+            spawned++;
+        }
+        grep_worker_main(&workers[0]);
+        for (int i = 1; i < spawned; i++) pthread_join(threads[i], NULL);
 
-    FILE *fp = ssh_popen(user, host, command);
-    if (!fp) {
-        fprintf(stderr, "Failed to execute SSH command for '%s'\n", path);
-        return 0;
+        for (int i = 0; i < n; i++) {
+            free(workers[i].buf);
+            free(workers[i].line);
+            align_free(&workers[i].align);
+        }
     }
 
-    load_stream(st, fp);
+    free(threads);
+    free(workers);
+    pthread_mutex_destroy(&g.store_lock);
+}
 
-    int status = pclose(fp);
-    if (status != 0) {
-        fprintf(stderr, "SSH command failed for '%s'\n", path);
-        return 0;
+// Takes the query as it stands for the next search. Returns 0 when there is
+// nothing to search for: an empty query lists nothing rather than every
+// line of every file.
+static int grep_prepare(FuzzyState *st) {
+    GrepConfig *cfg = &st->grep;
+    memcpy(cfg->query, st->query, sizeof(cfg->query));
+    cfg->query_len = st->query_len;
+    cfg->mode = st->match_mode;
+    cfg->algo = st->algo;
+    cfg->case_sensitive = st->case_sensitive;
+    cfg->cancel = 0;
+    cfg->files_done = 0;
+    cfg->hits = 0;
+    cfg->truncated = 0;
+    cfg->started = cfg->want;
+    return cfg->file_count > 0 && cfg->query_len > 0;
+}
+
+// Stops the search in flight, waiting for its workers to wind down.
+static void grep_stop(FuzzyState *st) {
+    Ingest *in = &st->ingest;
+    if (!st->grep_mode || !in->active) return;
+
+    __atomic_store_n(&st->grep.cancel, 1, __ATOMIC_RELAXED);
+    pthread_join(in->thread, NULL);
+    in->active = 0;
+}
+
+static int ingest_start(FuzzyState *st);
+
+// The query or mode changed: drop the old hits and search again.
+static void grep_restart(FuzzyState *st) {
+    Ingest *in = &st->ingest;
+
+    grep_stop(st);
+    clear_lines(st);
+    in->published = 0;
+    in->done = 0;
+    in->bytes = 0;
+    in->finished_ms = 0;
+
+    update_matches(st);
+    if (grep_prepare(st)) ingest_start(st);
+}
+
+// Main loop side: restarts the search once the keys typed so far are in.
+static void grep_kick(FuzzyState *st) {
+    if (st->grep_mode && st->grep.want != st->grep.started) grep_restart(st);
+}
+
+// Reads a pipe to EOF, up to GREP_SLURP_MAX bytes. Returns 0 on a read
+// error or when out of memory.
+static int grep_slurp(int fd, const char *path, char **out, size_t *out_len) {
+    char *buf = NULL;
+    size_t len = 0, cap = 0;
+
+    for (;;) {
+        if (len == GREP_SLURP_MAX) {
+            fprintf(stderr, "Warning: only the first %zu MB of '%s' are searched\n",
+                    GREP_SLURP_MAX >> 20, path);
+            break;
+        }
+        if (len == cap) {
+            size_t ncap = cap ? cap * 2 : LINE_READER_BLOCK;
+            if (ncap > GREP_SLURP_MAX) ncap = GREP_SLURP_MAX;
+            char *nbuf = (char*)realloc(buf, ncap);
+            if (!nbuf) {
+                free(buf);
+                return 0;
+            }
+            buf = nbuf;
+            cap = ncap;
+        }
+        ssize_t n = read(fd, buf + len, cap - len);
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0) {
+            free(buf);
+            return 0;
+        }
+        if (n == 0) break;
+        len += (size_t)n;
+    }
+
+    *out = buf ? buf : (char*)malloc(1);
+    *out_len = len;
+    return *out != NULL;
+}
+
+// Keeps the -G arguments that can be searched; the rest are reported up
+// front. Regular files are reopened by every search. Pipes, such as
+// -G <(cmd), are read once here. Anything else, such as a directory or a
+// device, is skipped.
+static int grep_open_files(FuzzyState *st) {
+    GrepConfig *cfg = &st->grep;
+    size_t n = (size_t)(st->input_file_count > 0 ? st->input_file_count : 1);
+    cfg->files = (char**)calloc(n, sizeof(char*));
+    cfg->data = (char**)calloc(n, sizeof(char*));
+    cfg->data_len = (size_t*)calloc(n, sizeof(size_t));
+    if (!cfg->files || !cfg->data || !cfg->data_len) return 0;
+
+    for (int i = 0; i < st->input_file_count; i++) {
+        const char *path = st->input_files[i];
+        if (strchr(path, ':')) {
+            fprintf(stderr, "Warning: SSH paths not supported in grep mode: %s\n", path);
+            continue;
+        }
+
+        int fd = open(path, O_RDONLY | O_CLOEXEC);
+        struct stat sb;
+        if (fd < 0 || fstat(fd, &sb) != 0) {
+            fprintf(stderr, "Warning: failed to open '%s': %s\n", path, strerror(errno));
+            if (fd >= 0) close(fd);
+            continue;
+        }
+
+        int k = cfg->file_count;
+        if (S_ISFIFO(sb.st_mode) || S_ISSOCK(sb.st_mode)) {
+            if (!grep_slurp(fd, path, &cfg->data[k], &cfg->data_len[k])) {
+                fprintf(stderr, "Warning: failed to read '%s': %s\n", path, strerror(errno));
+                close(fd);
+                continue;
+            }
+        } else if (!S_ISREG(sb.st_mode)) {
+            fprintf(stderr, "Warning: skipping '%s': not a regular file or pipe\n", path);
+            close(fd);
+            continue;
+        }
+        close(fd);
+        cfg->files[cfg->file_count++] = st->input_files[i];
+    }
+    return cfg->file_count > 0;
+}
+
+static void *ingest_thread_main(void *arg) {
+    FuzzyState *st = (FuzzyState*)arg;
+    Ingest *in = &st->ingest;
+
+    for (int i = 0; i < in->source_count; i++) {
+        ingest_stream(st, in->sources[i]);
     }
+    if (st->walk.root) ingest_walk(st);
+    if (st->grep_mode && st->grep.query_len > 0) ingest_grep(st);
+
+    in->finished_ms = now_ms();
+    __atomic_store_n(&in->done, 1, __ATOMIC_RELEASE);
+    ingest_notify(in);
+    return NULL;
+}
+
+static int ingest_add_source(FuzzyState *st, FILE *fp, int is_pipe) {
+    Ingest *in = &st->ingest;
+
+    FILE **sources = (FILE**)realloc(in->sources, (size_t)(in->source_count + 1) * sizeof(FILE*));
+    if (!sources) return 0;
+    in->sources = sources;
+
+    int *pipes = (int*)realloc(in->source_is_pipe, (size_t)(in->source_count + 1) * sizeof(int));
+    if (!pipes) return 0;
+    in->source_is_pipe = pipes;
 
+    in->sources[in->source_count] = fp;
+    in->source_is_pipe[in->source_count] = is_pipe;
+    in->source_count++;
     return 1;
 }
-static int load_files(FuzzyState *st, int argc, char **argv, int first_file_idx) {
-    int loaded_any = 0;
+
+// Opens every file argument up front so bad paths are reported before the UI
+// starts; the reads themselves happen on the ingest thread.
+static int ingest_open_files(FuzzyState *st, int argc, char **argv, int first_file_idx) {
     for (int i = first_file_idx; i < argc; i++) {
         const char *path = argv[i];
 
-        if (strchr(path, ':')) {
-            if (load_ssh_file(st, path)) {
-                loaded_any = 1;
-                if (st->line_count >= MAX_LINES) break;
+        if (strchr(path, ':') && access(path, R_OK) != 0) {
+            FILE *fp = open_ssh_file(st, path);
+            if (fp) {
+                if (!ingest_add_source(st, fp, 1)) pclose(fp);
                 continue;
             }
         }
@@ -1321,53 +4891,208 @@ static int load_files(FuzzyState *st, int argc, char **argv, int first_file_idx)
             fprintf(stderr, "nfzf: failed to open '%s': %s\n", path, strerror(errno));
             continue;
         }
-        load_stream(st, fp);
-        fclose(fp);
-        loaded_any = 1;
-        if (st->line_count >= MAX_LINES) break;
+        if (!ingest_add_source(st, fp, 0)) fclose(fp);
     }
-    return loaded_any;
+    return st->ingest.source_count > 0;
 }
 
-static int load_files_grep(FuzzyState *st, int argc, char **argv, int first_file_idx) {
-    int loaded_any = 0;
+// Reads every source to the end on the calling thread.
+static void ingest_read_all(FuzzyState *st) {
+    int from = st->line_count;
+    if (!st->ingest.started_ms) st->ingest.started_ms = now_ms();
 
-    for (int i = first_file_idx; i < argc; i++) {
-        const char *path = argv[i];
+    ingest_thread_main(st);
+    if (!ensure_line_capacity(st, st->store.count)) {
+        fprintf(stderr, "Warning: failed to grow line index\n");
+        return;
+    }
+    st->line_count = st->store.count;
 
-        if (strchr(path, ':')) {
-            fprintf(stderr, "Warning: SSH paths not supported in grep mode: %s\n", path);
-            continue;
+    for (int i = from; i < st->line_count && !st->ansi_render; i++) {
+        const LineRec *rec = store_rec(&st->store, i);
+        if (rec->plain_len != rec->raw_len) st->ansi_render = 1;
+    }
+}
+
+static int ingest_start(FuzzyState *st) {
+    Ingest *in = &st->ingest;
+    if (in->source_count == 0 && !st->walk.root &&
+        !(st->grep_mode && st->grep.query_len > 0 && st->grep.file_count > 0)) {
+        return 0;
+    }
+
+    in->published = st->line_count;
+    in->started_ms = now_ms();
+
+    // Without the pipe the UI falls back to checking every frame.
+    if (!in->wake_ready && pipe(in->wake) == 0) {
+        fcntl(in->wake[0], F_SETFL, O_NONBLOCK);
+        fcntl(in->wake[1], F_SETFL, O_NONBLOCK);
+        fcntl(in->wake[0], F_SETFD, FD_CLOEXEC);
+        fcntl(in->wake[1], F_SETFD, FD_CLOEXEC);
+        in->wake_ready = 1;
+    }
+    in->wake_armed = 0;
+
+    if (pthread_create(&in->thread, NULL, ingest_thread_main, st) != 0) {
+        // No thread: read synchronously, the old way.
+        ingest_read_all(st);
+        return 0;
+    }
+
+    in->active = 1;
+    return 1;
+}
+
+static void ingest_close_sources(FuzzyState *st) {
+    Ingest *in = &st->ingest;
+    for (int i = 0; i < in->source_count; i++) {
+        if (in->sources[i] == stdin) continue;
+        if (in->source_is_pipe[i]) pclose(in->sources[i]);
+        else fclose(in->sources[i]);
+    }
+    free(in->sources);
+    free(in->source_is_pipe);
+    in->sources = NULL;
+    in->source_is_pipe = NULL;
+    in->source_count = 0;
+}
+
+// Called from the UI loop: adopts lines published since the last call, scores
+// them against the current query and reaps the thread once it has finished.
+// Returns 1 when anything visible changed.
+static int ingest_poll(FuzzyState *st) {
+    Ingest *in = &st->ingest;
+    if (!in->active) return 0;
+
+    // New lines are folded into the live results, so wait until those are
+    // current; the next scan covers whatever arrived in the meantime.
+    if (!matcher_current(st)) return 0;
+
+    if (in->wake_ready) {
+        char buf[64];
+        while (read(in->wake[0], buf, sizeof(buf)) > 0) {}
+    }
+
+    int done = __atomic_load_n(&in->done, __ATOMIC_ACQUIRE);
+    int published = __atomic_load_n(&in->published, __ATOMIC_ACQUIRE);
+    int changed = 0;
+
+    if (published > st->line_count && ensure_line_capacity(st, published)) {
+        int from = st->line_count;
+
+        for (int i = from; i < published && !st->ansi_render; i++) {
+            const LineRec *rec = store_rec(&st->store, i);
+            if (rec->plain_len != rec->raw_len) st->ansi_render = 1;
         }
 
-        load_file_grep(st, path);
-        loaded_any = 1;
+        st->line_count = published;
 
-        if (st->line_count >= MAX_LINES) {
-            fprintf(stderr, "Warning: MAX_LINES (%d) reached, some files not loaded\n", MAX_LINES);
-            break;
+        // Large batches are scored on the matcher thread so a fast producer
+        // never stalls input; matcher_poll merges them in when done.
+        if (st->matcher.active && published - from >= POOL_GRAIN) {
+            matcher_begin(st, from);
         }
+        if (!st->matcher.busy) extend_matches(st, from);
+        in->adopted_ms = now_ms();
+        changed = 1;
+    }
+
+    if (done && st->line_count == published) {
+        pthread_join(in->thread, NULL);
+        in->active = 0;
+        ingest_close_sources(st);
+        changed = 1;
+    }
+
+    return changed;
+}
+
+// On exit a reader still blocked on a slow pipe is detached rather than
+// joined; free_state then leaves the store it is writing to alone.
+static void ingest_shutdown(FuzzyState *st) {
+    Ingest *in = &st->ingest;
+
+    if (in->active && __atomic_load_n(&in->done, __ATOMIC_ACQUIRE)) {
+        pthread_join(in->thread, NULL);
+        in->active = 0;
+        ingest_close_sources(st);
+    } else if (in->active) {
+        // It may still write to the wake pipe, so that stays open too.
+        pthread_detach(in->thread);
+        return;
+    } else {
+        ingest_close_sources(st);
     }
 
-    return loaded_any;
+    if (in->wake_ready) {
+        close(in->wake[0]);
+        close(in->wake[1]);
+        in->wake_ready = 0;
+    }
 }
 
-static void load_stdin(FuzzyState *st) {
-    load_stream(st, stdin);
+// Main loop side: returns how long the loop may sleep as far as ingest is
+// concerned (-1 for no limit) and, in *fd, the wake pipe to poll, if any.
+// New lines are taken in at most once per INGEST_FRAME_MS.
+static int ingest_wait(FuzzyState *st, int *fd) {
+    Ingest *in = &st->ingest;
+    *fd = -1;
+    if (!in->active) return -1;
+    if (!in->wake_ready) return INGEST_FRAME_MS;
+
+    // While the results are catching up, the matcher's wakeup comes first.
+    if (!matcher_current(st)) return -1;
+
+    long left = in->adopted_ms + INGEST_FRAME_MS - now_ms();
+    if (left > 0) return (int)left;
+
+    __atomic_store_n(&in->wake_armed, 1, __ATOMIC_SEQ_CST);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&in->published, __ATOMIC_RELAXED) > st->line_count ||
+        __atomic_load_n(&in->done, __ATOMIC_RELAXED)) {
+        return 0;
+    }
+    *fd = in->wake[0];
+    return -1;
 }
 
 static void free_state(FuzzyState *st) {
-    for (int i = 0; i < st->line_count; i++) {
-        free(st->lines[i]);
-        free(st->raw_lines[i]);
-        st->lines[i] = NULL;
-        st->raw_lines[i] = NULL;
+    matcher_shutdown(st);
+    grep_stop(st);
+    ingest_shutdown(st);
+
+    // A detached reader may still be appending; the process is exiting anyway.
+    if (!st->ingest.active) {
+        line_store_free(&st->store);
+        line_store_free(&st->spare_store);
+        st->line_count = 0;
+
+        if (st->walk.prefix) close(st->walk.fd);
+        free(st->walk.root);
+        free(st->walk.prefix);
+        free(st->walk.excludes);
+        st->walk.root = NULL;
     }
 
+    match_cache_clear(&st->match_cache);
+    pool_destroy(&st->pool);
+    pool_destroy(&st->stat_pool);
+    if (st->dir_fd >= 0) close(st->dir_fd);
+    dir_cache_shutdown(st);
+    ssh_session_close(st);
+    align_free(&st->align);
+    span_cache_free(st);
     free(st->scores);
     free(st->match_indices);
+    free(st->reject_indices);
     free(st->source_files);
-    free(st->line_numbers);
+    free(st->grep.files);
+    if (st->grep.data) {
+        for (int i = 0; i < st->grep.file_count; i++) free(st->grep.data[i]);
+        free(st->grep.data);
+    }
+    free(st->grep.data_len);
 
     if (st->input_files) {
         for (int i = 0; i < st->input_file_count; i++) {
@@ -1380,25 +5105,21 @@ static void free_state(FuzzyState *st) {
         regfree(&st->regex);
     }
 
+    live_stop(st);
     free(st->live_cmd);
+    free(st->live_hashes);
+    free(st->perf.keys.us);
+    free(st->perf.updates.us);
+    free(st->perf.frames.us);
+    free(st->view.rows);
 }
 
-static void draw_status_bar(FuzzyState *st) {
+// Redraws the status line only when its text differs from the last frame.
+// Returns 1 if it was drawn.
+static int draw_status_bar(FuzzyState *st) {
     int max_y = getmaxy(stdscr);
     int max_x = getmaxx(stdscr);
 
-    attron(COLOR_PAIR(COLOR_NORMAL));
-    mvhline(max_y - 2, 0, ACS_HLINE, max_x);
-    attroff(COLOR_PAIR(COLOR_NORMAL));
-
-    move(max_y - 1, 0);
-    clrtoeol();
-
-    attron(COLOR_PAIR(COLOR_STATUS) | A_BOLD);
-
-    mvprintw(max_y - 1, 1, "NBL Fuzzy Filter | ");
-    int nbl_len = 19;
-
     const char *mode_str;
     int mode_color;
     if (st->mode == MODE_INSERT) {
@@ -1409,36 +5130,95 @@ static void draw_status_bar(FuzzyState *st) {
         mode_color = COLOR_MATCH;
     }
 
+    int nbl_len = 19;
+    int mode_len = (int)strlen(mode_str) + 3;
+    int status_start = nbl_len + mode_len;
+
+    const char *match_mode_str;
+    switch (st->match_mode) {
+        case MATCH_EXACT: match_mode_str = "EXACT"; break;
+        case MATCH_REGEX: match_mode_str = "REGEX"; break;
+        default: match_mode_str = "FUZZY"; break;
+    }
+
+    char ingest[64];
+    ingest[0] = '\0';
+    if (st->ingest.active) {
+        char lines[16], bytes[16];
+        format_count(lines, sizeof(lines), (uint64_t)st->line_count);
+        format_bytes(bytes, sizeof(bytes), __atomic_load_n(&st->ingest.bytes, __ATOMIC_RELAXED));
+        if (st->grep_mode) {
+            snprintf(ingest, sizeof(ingest), " | searching %d/%d files",
+                     __atomic_load_n(&st->grep.files_done, __ATOMIC_RELAXED), st->grep.file_count);
+        } else {
+            snprintf(ingest, sizeof(ingest), " | reading %s lines %s", lines, bytes);
+        }
+    } else if (st->grep_mode && st->grep.truncated) {
+        char hits[16];
+        format_count(hits, sizeof(hits), (uint64_t)GREP_MAX_HITS);
+        snprintf(ingest, sizeof(ingest), " | first %s hits", hits);
+    } else if (st->live_mode) {
+        // How long the command takes, so a slow one explains the pace.
+        char took[32];
+        long running = st->live.pid > 0 ? now_ms() - st->live.started_ms : 0;
+        if (running >= LIVE_STATUS_SHOW_MS) {
+            format_duration(took, sizeof(took), running);
+            snprintf(ingest, sizeof(ingest), " | live running %s", took);
+        } else if (st->live.run_ms > 0 || st->live.next_ms > 0) {
+            format_duration(took, sizeof(took), st->live.run_ms);
+            snprintf(ingest, sizeof(ingest), " | live %s", took);
+        }
+    }
+
+    char left[256];
+    snprintf(left, sizeof(left), " | %d/%d matches | Mode: %s%s%s%s%s%s%s",
+             st->match_count > 0 ? st->selected + 1 : 0,
+             st->match_count,
+             match_mode_str,
+             st->case_sensitive ? " (case)" : "",
+             st->show_hidden ? " | hidden" : "",
+             st->is_directory_mode ? " | dir" : "",
+             st->ssh_mode ? " | SSH" : "",
+             st->grep_mode ? " | grep" : "",
+             ingest);
+
+    int regex_error = (st->match_mode == MATCH_REGEX && st->regex_valid < 0);
+
+    char right[300];
+    right[0] = '\0';
+    if (st->query_len > 0) {
+        snprintf(right, sizeof(right), "Query: %s ", st->query);
+    } else if (st->is_directory_mode) {
+        if (st->ssh_mode) {
+            snprintf(right, sizeof(right), "%s@%s:%s ",
+                    st->ssh_user[0] ? st->ssh_user : "ssh",
+                    st->ssh_host, st->current_dir);
+        } else {
+            snprintf(right, sizeof(right), "Dir: %s ", st->current_dir);
+        }
+    }
+
+    char sig[sizeof(st->view.status)];
+    snprintf(sig, sizeof(sig), "%d|%s|%s|%d|%s", max_x, mode_str, left, regex_error, right);
+    if (strcmp(sig, st->view.status) == 0) return 0;
+    memcpy(st->view.status, sig, sizeof(sig));
+
+    move(max_y - 1, 0);
+    clrtoeol();
+
+    attron(COLOR_PAIR(COLOR_STATUS) | A_BOLD);
+
+    mvprintw(max_y - 1, 1, "NBL Fuzzy Filter | ");
+
     attroff(COLOR_PAIR(COLOR_STATUS) | A_BOLD);
     attron(COLOR_PAIR(mode_color) | A_BOLD);
     mvprintw(max_y - 1, nbl_len, " [%s]", mode_str);
     attroff(COLOR_PAIR(mode_color) | A_BOLD);
     attron(COLOR_PAIR(COLOR_STATUS) | A_BOLD);
 
-    int mode_len = (int)strlen(mode_str) + 3;
-    int status_start = nbl_len + mode_len;
-
-    const char *match_mode_str;
-    switch (st->match_mode) {
-        case MATCH_EXACT: match_mode_str = "EXACT"; break;
-        case MATCH_REGEX: match_mode_str = "REGEX"; break;
-        default: match_mode_str = "FUZZY"; break;
-    }
-
-    char left[256];
-    snprintf(left, sizeof(left), " | %d/%d matches | Mode: %s%s%s%s%s%s",
-             st->match_count > 0 ? st->selected + 1 : 0,
-             st->match_count,
-             match_mode_str,
-             st->case_sensitive ? " (case)" : "",
-             st->show_hidden ? " | hidden" : "",
-             st->is_directory_mode ? " | dir" : "",
-             st->ssh_mode ? " | SSH" : "",
-             st->grep_mode ? " | grep" : "");
-
     mvprintw(max_y - 1, status_start, "%s", left);
 
-    if (st->match_mode == MATCH_REGEX && st->regex_valid < 0) {
+    if (regex_error) {
         attron(COLOR_PAIR(COLOR_ERROR) | A_BOLD);
         int error_x = status_start + (int)strlen(left) + 2;
         if (error_x < max_x - 20) {
@@ -1448,132 +5228,269 @@ static void draw_status_bar(FuzzyState *st) {
         attron(COLOR_PAIR(COLOR_STATUS) | A_BOLD);
     }
 
-    if (st->query_len > 0) {
-        char right[300];
-        snprintf(right, sizeof(right), "Query: %s ", st->query);
-        int rx = max_x - (int)strlen(right) - 1;
-        if (rx < status_start) rx = status_start;
-        mvprintw(max_y - 1, rx, "%s", right);
-    } else if (st->is_directory_mode) {
-        char right[300];
-        if (st->ssh_mode) {
-            snprintf(right, sizeof(right), "%s@%s:%s ",
-                    st->ssh_user[0] ? st->ssh_user : "ssh",
-                    st->ssh_host, st->current_dir);
-        } else {
-            snprintf(right, sizeof(right), "Dir: %s ", st->current_dir);
-        }
+    if (right[0]) {
         int rx = max_x - (int)strlen(right) - 1;
         if (rx < status_start) rx = status_start;
         mvprintw(max_y - 1, rx, "%s", right);
     }
 
     attroff(COLOR_PAIR(COLOR_STATUS) | A_BOLD);
+    return 1;
 }
 
-static void highlight_matches_plain(const char *line, const char *query, int y, int x_start, int max_x, int case_sensitive) {
-    if (!query || !*query) {
-        mvprintw(y, x_start, "%.*s", max_x - x_start, line);
-        return;
+// Writes n bytes at the cursor with a single addnstr per buffer, keeping one
+// column per byte: tabs become spaces, as in the ANSI renderer, so match
+// spans stay aligned with the text.
+static void add_plain_run(const char *s, int n) {
+    char buf[256];
+    while (n > 0) {
+        int k = n < (int)sizeof(buf) ? n : (int)sizeof(buf);
+        for (int j = 0; j < k; j++) buf[j] = s[j] == '\t' ? ' ' : s[j];
+        addnstr(buf, k);
+        s += k;
+        n -= k;
     }
+}
 
-    int q_len = (int)strlen(query);
-    int l_len = (int)strlen(line);
-    int x = x_start;
+static void highlight_matches_plain(const char *line, int l_len, const MatchSpan *spans, int span_count,
+                                    int y, int x_start, int max_x) {
+    int end = l_len < max_x - x_start ? l_len : max_x - x_start;
+    move(y, x_start);
+
+    // Alternate between the text before a span and the span itself, one
+    // addnstr per run.
+    int i = 0;
+    for (int span = 0; span < span_count && i < end; span++) {
+        int start = (int)spans[span].start;
+        int stop = (int)(spans[span].start + spans[span].len);
+        if (stop > end) stop = end;
+        if (stop <= i) continue;
+        if (start < i) start = i;
+        if (start > stop) start = stop;
+
+        if (start > i) add_plain_run(line + i, start - i);
+        if (stop > start) {
+            attron(COLOR_PAIR(COLOR_MATCH) | A_BOLD);
+            add_plain_run(line + start, stop - start);
+            attroff(COLOR_PAIR(COLOR_MATCH) | A_BOLD);
+        }
+        i = stop;
+    }
+    if (i < end) add_plain_run(line + i, end - i);
+}
 
-    int matched[MAX_LINE_LEN] = {0};
+// Forgets what is on screen so the next frame repaints every row and both
+// status lines.
+static void invalidate_screen(FuzzyState *st) {
+    st->view.valid = 0;
+    st->view.status[0] = '\0';
+    st->view.separator[0] = '\0';
+    erase();
+}
 
-    int q_idx = 0;
-    for (int l_idx = 0; l_idx < l_len && q_idx < q_len && x < max_x; l_idx++) {
-        char q_ch = query[q_idx];
-        char l_ch = line[l_idx];
+// The execute bit of a -D file entry, looked up the first time its row is
+// drawn rather than for every entry in the listing.
+static int line_exec_bit(FuzzyState *st, int idx) {
+    LineRec *rec = store_rec_mut(&st->store, idx);
 
-        if (!case_sensitive) {
-            if (q_ch >= 'A' && q_ch <= 'Z') q_ch = (char)(q_ch - 'A' + 'a');
-            if (l_ch >= 'A' && l_ch <= 'Z') l_ch = (char)(l_ch - 'A' + 'a');
-        }
+    if (rec->flags & LINE_EXEC_PENDING) {
+        struct stat sb;
+        int exec = st->dir_fd >= 0 && fstatat(st->dir_fd, line_raw(st, idx), &sb, 0) == 0 &&
+                   !S_ISDIR(sb.st_mode) && (sb.st_mode & S_IXUSR);
+        rec->flags = exec ? LINE_EXEC : 0;
+    }
+    return (rec->flags & LINE_EXEC) != 0;
+}
 
-        if (q_ch == l_ch) {
-            matched[l_idx] = 1;
-            q_idx++;
-        }
+static void draw_row(FuzzyState *st, int y, int match_idx, int max_x) {
+    move(y, 0);
+    clrtoeol();
+    if (match_idx >= st->match_count) return;
+
+    int line_idx = st->match_indices[match_idx];
+    const char *plain = line_plain(st, line_idx);
+    const char *raw   = line_raw(st, line_idx);
+    int plain_len = (int)store_rec(&st->store, line_idx)->plain_len;
+    const SpanEntry *spans = line_spans(st, line_idx);
+
+    int is_selected = (match_idx == st->selected);
+    int exec_flag = line_exec_bit(st, line_idx);
+    int is_executable = exec_flag || (plain_len > 0 && plain[plain_len - 1] == '*');
+
+    attr_t base_attr = 0;
+    short base_pair = COLOR_NORMAL;
+
+    if (is_selected) {
+        base_attr = A_REVERSE | A_BOLD;
+        base_pair = COLOR_SELECTED;
+        attron(COLOR_PAIR(COLOR_SELECTED) | A_REVERSE | A_BOLD);
+        mvhline(y, 0, ' ', max_x);
+    } else if (is_executable) {
+        base_attr = 0;
+        base_pair = COLOR_EXECUTABLE;
+        attron(COLOR_PAIR(COLOR_EXECUTABLE));
+    } else {
+        base_attr = 0;
+        base_pair = COLOR_NORMAL;
+        attron(COLOR_PAIR(COLOR_NORMAL));
     }
 
-    for (int i = 0; i < l_len && x < max_x; i++) {
-        if (matched[i]) {
-            attron(COLOR_PAIR(COLOR_MATCH) | A_BOLD);
-            mvaddch(y, x++, (chtype)line[i]);
-            attroff(COLOR_PAIR(COLOR_MATCH) | A_BOLD);
-        } else {
-            mvaddch(y, x++, (chtype)line[i]);
-        }
+    mvprintw(y, 1, is_selected ? "> " : "  ");
+
+    if (st->ansi_render && raw) {
+        render_ansi_line_with_matches(raw, spans->spans, spans->count, y, 3, max_x, base_attr, base_pair);
+    } else {
+        highlight_matches_plain(plain, plain_len, spans->spans, spans->count, y, 3, max_x);
+    }
+    if (exec_flag && 3 + plain_len < max_x) mvaddch(y, 3 + plain_len, '*');
+
+    if (is_selected) {
+        attroff(COLOR_PAIR(COLOR_SELECTED) | A_REVERSE | A_BOLD);
+    } else if (is_executable) {
+        attroff(COLOR_PAIR(COLOR_EXECUTABLE));
+    } else {
+        attroff(COLOR_PAIR(COLOR_NORMAL));
     }
 }
 
-static void draw_results(FuzzyState *st) {
+// Repaints only the rows whose line, selection or highlight changed since the
+// last frame. A scroll by less than a screenful moves the rows that are still
+// visible with a hardware scroll region, so only the exposed rows are drawn.
+// Returns 1 if anything was drawn.
+static int draw_results(FuzzyState *st) {
+    ViewState *v = &st->view;
     int max_y = getmaxy(stdscr);
     int max_x = getmaxx(stdscr);
-
-    for (int y = 0; y < max_y - 2; y++) {
-        move(y, 0);
-        clrtoeol();
+    int visible_lines = max_y - 2;
+    if (visible_lines < 1) return 0;
+
+    ensure_sorted(st, st->scroll_offset + visible_lines);
+
+    if (!v->valid || v->row_count != visible_lines || v->cols != max_x) {
+        RowState *rows = (RowState*)realloc(v->rows, (size_t)visible_lines * sizeof(RowState));
+        if (!rows) return 0;
+        v->rows = rows;
+        v->row_count = visible_lines;
+        v->cols = max_x;
+        v->scroll = st->scroll_offset;
+        for (int i = 0; i < visible_lines; i++) v->rows[i].line = -2;
+        v->valid = 1;
     }
 
-    int visible_lines = max_y - 2;
+    int delta = st->scroll_offset - v->scroll;
+    if (delta != 0 && abs(delta) < visible_lines) {
+        scrollok(stdscr, TRUE);
+        setscrreg(0, visible_lines - 1);
+        scrl(delta);
+        setscrreg(0, max_y - 1);
+        scrollok(stdscr, FALSE);
+
+        if (delta > 0) {
+            memmove(v->rows, v->rows + delta, (size_t)(visible_lines - delta) * sizeof(RowState));
+            for (int i = visible_lines - delta; i < visible_lines; i++) v->rows[i].line = -2;
+        } else {
+            memmove(v->rows - delta, v->rows, (size_t)(visible_lines + delta) * sizeof(RowState));
+            for (int i = 0; i < -delta; i++) v->rows[i].line = -2;
+        }
+    } else if (delta != 0) {
+        for (int i = 0; i < visible_lines; i++) v->rows[i].line = -2;
+    }
+    v->scroll = st->scroll_offset;
 
+    int drawn = 0;
     for (int i = 0; i < visible_lines; i++) {
         int match_idx = st->scroll_offset + i;
-        if (match_idx >= st->match_count) break;
-
-        int line_idx = st->match_indices[match_idx];
-        const char *plain = st->lines[line_idx];
-        const char *raw   = st->raw_lines[line_idx];
-
-        int is_selected = (match_idx == st->selected);
-        int is_executable = (plain && strlen(plain) > 0 && plain[strlen(plain) - 1] == '*');
-
-        attr_t base_attr = 0;
-        short base_pair = COLOR_NORMAL;
-
-        if (is_selected) {
-            base_attr = A_REVERSE | A_BOLD;
-            base_pair = COLOR_SELECTED;
-            attron(COLOR_PAIR(COLOR_SELECTED) | A_REVERSE | A_BOLD);
-            mvhline(i, 0, ' ', max_x);
-        } else if (is_executable) {
-            base_attr = 0;
-            base_pair = COLOR_EXECUTABLE;
-            attron(COLOR_PAIR(COLOR_EXECUTABLE));
-        } else {
-            base_attr = 0;
-            base_pair = COLOR_NORMAL;
-            attron(COLOR_PAIR(COLOR_NORMAL));
+
+        RowState want;
+        memset(&want, 0, sizeof(want));
+        want.line = match_idx < st->match_count ? st->match_indices[match_idx] : -1;
+        if (want.line >= 0) {
+            want.selected = (match_idx == st->selected);
+            want.ansi = st->ansi_render;
+            want.span_gen = st->span_gen;
+            want.store_gen = st->store_gen;
         }
 
-        mvprintw(i, 1, is_selected ? "> " : "  ");
+        if (memcmp(&want, &v->rows[i], sizeof(want)) == 0) continue;
 
-        if (st->ansi_render && raw) {
-            int mask[MAX_LINE_LEN];
-            build_matched_mask(plain ? plain : "", st->query, st->case_sensitive, mask, MAX_LINE_LEN);
-            render_ansi_line_with_matches(raw, mask, MAX_LINE_LEN, i, 3, max_x, base_attr, base_pair);
-        } else {
-            highlight_matches_plain(plain ? plain : "", st->query, i, 3, max_x, st->case_sensitive);
-        }
+        draw_row(st, i, match_idx, max_x);
+        v->rows[i] = want;
+        drawn = 1;
+    }
 
-        if (is_selected) {
-            attroff(COLOR_PAIR(COLOR_SELECTED) | A_REVERSE | A_BOLD);
-        } else if (is_executable) {
-            attroff(COLOR_PAIR(COLOR_EXECUTABLE));
-        } else {
-            attroff(COLOR_PAIR(COLOR_NORMAL));
-        }
+    return drawn;
+}
+
+// Ctrl+T overlay, drawn over the separator above the status bar: what the
+// last keystroke cost to match, the previous frame's render time, ingest
+// throughput and how much the line store holds.
+static void format_perf_overlay(FuzzyState *st, char *text, size_t size) {
+    Perf *p = &st->perf;
+
+    char rate[32] = "-";
+    long start = st->ingest.started_ms;
+    long end = st->ingest.active ? now_ms() : st->ingest.finished_ms;
+    if (start > 0 && end > start) {
+        char bytes[16];
+        uint64_t total = __atomic_load_n(&st->ingest.bytes, __ATOMIC_RELAXED);
+        format_bytes(bytes, sizeof(bytes), total * 1000 / (uint64_t)(end - start));
+        snprintf(rate, sizeof(rate), "%s/s", bytes);
+    }
+
+    char lines[16], held[16];
+    format_count(lines, sizeof(lines), (uint64_t)st->line_count);
+    format_bytes(held, sizeof(held), line_store_bytes(&st->store) + line_store_bytes(&st->spare_store));
+
+    snprintf(text, size,
+             " match %.2fms (score %.2f + rank %.2f) | frame %.2fms | ingest %s | %s lines | store %s ",
+             p->update_us / 1000.0, (p->update_us - p->rank_us) / 1000.0, p->rank_us / 1000.0,
+             p->frame_us / 1000.0, rate, lines, held);
+}
+
+// The separator above the status bar, with the overlay on it when enabled.
+// Redrawn only when the overlay text, or its presence, changes.
+static int draw_separator(FuzzyState *st) {
+    int max_y = getmaxy(stdscr);
+    int max_x = getmaxx(stdscr);
+
+    char text[sizeof(st->view.separator) - 16];
+    text[0] = '\0';
+    if (st->perf.overlay) format_perf_overlay(st, text, sizeof(text));
+
+    char sig[sizeof(st->view.separator)];
+    snprintf(sig, sizeof(sig), "%d|%s", max_x, text);
+    if (strcmp(sig, st->view.separator) == 0) return 0;
+    memcpy(st->view.separator, sig, sizeof(sig));
+
+    attron(COLOR_PAIR(COLOR_NORMAL));
+    mvhline(max_y - 2, 0, ACS_HLINE, max_x);
+    attroff(COLOR_PAIR(COLOR_NORMAL));
+
+    if (text[0]) {
+        int x = max_x - (int)strlen(text) - 1;
+        if (x < 0) x = 0;
+
+        attron(COLOR_PAIR(COLOR_QUERY) | A_BOLD);
+        mvprintw(max_y - 2, x, "%.*s", max_x - x, text);
+        attroff(COLOR_PAIR(COLOR_QUERY) | A_BOLD);
     }
+    return 1;
 }
 
 static void draw_ui(FuzzyState *st) {
-    draw_results(st);
-    draw_status_bar(st);
+    long started = now_us();
+
+    int changed = draw_results(st);
+    changed |= draw_status_bar(st);
+    int overlay_changed = draw_separator(st);
+    if (!changed && !overlay_changed) return;
     refresh();
+
+    // A frame that only repainted the overlay is not counted, or the overlay
+    // would keep redrawing itself to show its own frame time.
+    if (!changed) return;
+    st->perf.frame_us = now_us() - started;
+    if (st->perf.enabled) latency_record(&st->perf.frames, st->perf.frame_us);
 }
 
 static void ensure_visible(FuzzyState *st) {
@@ -1633,7 +5550,7 @@ static void add_char(FuzzyState *st, char c) {
             st->regex_valid = 0;
         }
 
-        update_matches(st);
+        request_matches(st);
     }
 }
 
@@ -1646,7 +5563,7 @@ static void delete_char(FuzzyState *st) {
             st->regex_valid = 0;
         }
 
-        update_matches(st);
+        request_matches(st);
     }
 }
 
@@ -1662,7 +5579,7 @@ static void delete_word(FuzzyState *st) {
         st->regex_valid = 0;
     }
 
-    update_matches(st);
+    request_matches(st);
 }
 
 static void clear_query(FuzzyState *st) {
@@ -1674,128 +5591,625 @@ static void clear_query(FuzzyState *st) {
         st->regex_valid = 0;
     }
 
-    update_matches(st);
+    request_matches(st);
+}
+
+static void toggle_exact_mode(FuzzyState *st) {
+    if (st->match_mode == MATCH_EXACT) st->match_mode = MATCH_FUZZY;
+    else st->match_mode = MATCH_EXACT;
+
+    if (st->regex_valid > 0) {
+        regfree(&st->regex);
+        st->regex_valid = 0;
+    }
+    request_matches(st);
+}
+
+static void toggle_fuzzy_mode(FuzzyState *st) {
+    if (st->match_mode == MATCH_FUZZY) st->match_mode = MATCH_EXACT;
+    else st->match_mode = MATCH_FUZZY;
+
+    if (st->regex_valid > 0) {
+        regfree(&st->regex);
+        st->regex_valid = 0;
+    }
+    request_matches(st);
+}
+
+static void toggle_regex_mode(FuzzyState *st) {
+    if (st->match_mode == MATCH_REGEX) {
+        if (st->regex_valid > 0) {
+            regfree(&st->regex);
+            st->regex_valid = 0;
+        }
+        st->match_mode = MATCH_FUZZY;
+    } else {
+        if (st->regex_valid > 0) {
+            regfree(&st->regex);
+        }
+        st->match_mode = MATCH_REGEX;
+        st->regex_valid = 0;
+    }
+    request_matches(st);
+}
+
+static void store_input_files(FuzzyState *st, int argc, char **argv, int first_file_idx) {
+    if (first_file_idx >= argc) {
+        st->input_file_count = 0;
+        st->input_files = NULL;
+        return;
+    }
+
+    int count = argc - first_file_idx;
+    st->input_files = (char**)calloc((size_t)count, sizeof(char*));
+    if (!st->input_files) {
+        fprintf(stderr, "Warning: failed to allocate memory for file list\n");
+        st->input_file_count = 0;
+        return;
+    }
+
+    st->input_file_count = 0;
+    for (int i = first_file_idx; i < argc; i++) {
+        st->input_files[st->input_file_count] = strdup(argv[i]);
+        if (st->input_files[st->input_file_count]) {
+            st->input_file_count++;
+        }
+    }
+}
+
+// Identity of a --live output line across refreshes. Word-at-a-time mixing;
+// it only has to keep the lines of one command's output apart, and a bytes
+// comparison backs up every hit.
+static uint64_t line_hash(const char *s, size_t len) {
+    uint64_t h = 0x9E3779B97F4A7C15ULL ^ (uint64_t)len;
+    while (len >= 8) {
+        uint64_t w;
+        memcpy(&w, s, 8);
+        h = (h ^ w) * 0xBF58476D1CE4E5B9ULL;
+        h ^= h >> 31;
+        s += 8;
+        len -= 8;
+    }
+    uint64_t w = 0;
+    memcpy(&w, s, len);
+    h = (h ^ w) * 0x94D049BB133111EBULL;
+    return h ^ (h >> 29);
+}
+
+static int store_lines_equal(const LineStore *a, int i, const LineStore *b, int j) {
+    const LineRec *ra = store_rec(a, i), *rb = store_rec(b, j);
+    return ra->raw_len == rb->raw_len &&
+           memcmp(store_raw(a, i), store_raw(b, j), ra->raw_len) == 0;
+}
+
+// Pairs each new line with an unclaimed identical old line, so lines that
+// survive a refresh keep their scores and the selection can follow them.
+// old_to_new gets the new index of every surviving old line, -1 for the rest;
+// new_to_old the reverse. Duplicates pair up in order.
+static int live_diff(const LineStore *old_store, const uint64_t *old_hash, int old_count,
+                     const LineStore *new_store, const uint64_t *new_hash, int new_count,
+                     int *old_to_new, int *new_to_old) {
+    size_t size = 16;
+    while (size < (size_t)old_count * 2) size <<= 1;
+
+    // Open-addressed on hash; each slot heads a chain of the old lines with
+    // that hash, in order. Claimed lines are unlinked as they pair up.
+    int *slot_head = (int*)malloc(size * sizeof(int));
+    int *next = (int*)malloc((size_t)(old_count > 0 ? old_count : 1) * sizeof(int));
+    if (!slot_head || !next) {
+        free(slot_head);
+        free(next);
+        return 0;
+    }
+    // -2 marks a slot never used; a drained chain leaves -1 so probing still
+    // walks past it.
+    for (size_t k = 0; k < size; k++) slot_head[k] = -2;
+
+    uint64_t *slot_key = (uint64_t*)malloc(size * sizeof(uint64_t));
+    if (!slot_key) {
+        free(slot_head);
+        free(next);
+        return 0;
+    }
+
+    for (int i = old_count - 1; i >= 0; i--) {
+        size_t k = old_hash[i] & (size - 1);
+        while (slot_head[k] != -2 && slot_key[k] != old_hash[i]) k = (k + 1) & (size - 1);
+        if (slot_head[k] == -2) {
+            slot_key[k] = old_hash[i];
+            slot_head[k] = -1;
+        }
+        next[i] = slot_head[k];
+        slot_head[k] = i;
+        old_to_new[i] = -1;
+    }
+
+    for (int j = 0; j < new_count; j++) {
+        new_to_old[j] = -1;
+        size_t k = new_hash[j] & (size - 1);
+        while (slot_head[k] != -2 && slot_key[k] != new_hash[j]) k = (k + 1) & (size - 1);
+        if (slot_head[k] < 0) continue;
+
+        int prev = -1;
+        for (int i = slot_head[k]; i >= 0; prev = i, i = next[i]) {
+            if (!store_lines_equal(old_store, i, new_store, j)) continue;
+            if (prev < 0) slot_head[k] = next[i];
+            else next[prev] = next[i];
+            old_to_new[i] = j;
+            new_to_old[j] = i;
+            break;
+        }
+    }
+
+    free(slot_key);
+    free(slot_head);
+    free(next);
+    return 1;
+}
+
+// Rebuilds the results after a refresh from the previous ones: surviving lines
+// carry their scores over and only lines new in this output are scored.
+// Returns 0 when that isn't possible and a full rescan is needed.
+static int live_rescore(FuzzyState *st, const int *new_to_old, const int *old_score) {
+    int *fresh = (int*)malloc((size_t)(st->line_count > 0 ? st->line_count : 1) * sizeof(int));
+    if (!fresh) return 0;
+
+    int fresh_count = 0;
+    for (int j = 0; j < st->line_count; j++) {
+        if (new_to_old[j] < 0) fresh[fresh_count++] = j;
+    }
+    // Mostly new output: a regular scan is no slower and can go parallel.
+    if (fresh_count >= PARALLEL_MIN_LINES) {
+        free(fresh);
+        return 0;
+    }
+
+    long started = now_us();
+    st->perf.rank_us = 0;
+    st->match_count = 0;
+    st->reject_count = 0;
+
+    if (st->query_len == 0) {
+        for (int j = 0; j < st->line_count; j++) {
+            st->scores[j] = 1000;
+            st->match_indices[st->match_count++] = j;
+        }
+        st->sorted_count = st->match_count;
+    } else {
+        if (st->match_mode == MATCH_REGEX && !st->regex_valid) {
+            regex_score(st->query, "", st->case_sensitive, &st->regex, &st->regex_valid,
+                        st->regex_error, sizeof(st->regex_error));
+        }
+
+        for (int j = 0; j < st->line_count; j++) {
+            int i = new_to_old[j];
+            if (i < 0) continue;
+            st->scores[j] = old_score[i];
+            if (old_score[i] >= 0) st->match_indices[st->match_count++] = j;
+        }
+
+        int fresh_sorted;
+        st->match_count += score_lines(st, fresh, fresh_count, 0, 0,
+                                       st->match_indices + st->match_count, &fresh_sorted);
+        // Ranked lazily by the next draw.
+        st->sorted_count = 0;
+        st->reject_count = 0;
+    }
+
+    free(fresh);
+    st->perf.update_us = now_us() - started;
+    span_cache_invalidate(st);
+    if (st->perf.enabled) latency_record(&st->perf.updates, st->perf.update_us);
+    return 1;
+}
+
+// A --live refresh is assembled in the spare store as output arrives. While
+// the output matches what we have, lines are only compared; the copy starts
+// at the first difference, so byte-identical output costs no copying at all.
+static void live_collect_begin(FuzzyState *st) {
+    LiveRun *lr = &st->live;
+    line_store_clear(&st->spare_store);
+    free(lr->hashes);
+    lr->hashes = NULL;
+    lr->hash_cap = 0;
+    lr->seen = 0;
+    lr->failed = 0;
+    lr->same = st->live_hash_count == st->line_count && st->line_count > 0;
+}
+
+// Copies the first `seen` current lines, which matched the output so far,
+// into the spare store.
+static void live_collect_prefix(FuzzyState *st, size_t cap) {
+    LiveRun *lr = &st->live;
+    LineStore *fresh = &st->spare_store;
+
+    lr->same = 0;
+    lr->hash_cap = cap;
+    lr->hashes = (uint64_t*)malloc(cap * sizeof(uint64_t));
+    for (int i = 0; lr->hashes && i < lr->seen; i++) {
+        const LineRec *rec = store_rec(&st->store, i);
+        if (!line_store_add(fresh, store_raw(&st->store, i), rec->raw_len)) break;
+        lr->hashes[i] = st->live_hashes[i];
+    }
+    if (!lr->hashes || fresh->count != lr->seen) lr->failed = 1;
+}
+
+static void live_collect_line(FuzzyState *st, const char *line, size_t len) {
+    LiveRun *lr = &st->live;
+    LineStore *fresh = &st->spare_store;
+    if (len == 0 || lr->failed) return;
+
+    if (lr->same) {
+        const char *nul = (const char*)memchr(line, '\0', len);
+        size_t n = nul ? (size_t)(nul - line) : len;
+        int i = lr->seen;
+        if (i < st->line_count && store_rec(&st->store, i)->raw_len == n &&
+            line_hash(line, n) == st->live_hashes[i] &&
+            memcmp(store_raw(&st->store, i), line, n) == 0) {
+            lr->seen++;
+            return;
+        }
+
+        live_collect_prefix(st, (size_t)lr->seen + 4096);
+        if (lr->failed) return;
+    }
+
+    if ((size_t)fresh->count == lr->hash_cap) {
+        size_t cap = lr->hash_cap ? lr->hash_cap * 2 : 4096;
+        uint64_t *grown = (uint64_t*)realloc(lr->hashes, cap * sizeof(uint64_t));
+        if (!grown) {
+            lr->failed = 1;
+            return;
+        }
+        lr->hashes = grown;
+        lr->hash_cap = cap;
+    }
+    if (!line_store_add(fresh, line, len)) return;
+
+    int j = fresh->count - 1;
+    lr->hashes[j] = line_hash(store_raw(fresh, j), store_rec(fresh, j)->raw_len);
+}
+
+// Output is complete: diffs it against the lines on screen by line hash.
+// Surviving lines keep their scores, only new ones are scored and the
+// selection stays on the same line if it is still there. Returns 1 if the
+// lines changed.
+static int live_collect_end(FuzzyState *st) {
+    LiveRun *lr = &st->live;
+    LineStore *fresh = &st->spare_store;
+
+    // The output stopped early but everything up to there matched: keep
+    // that prefix. (No output at all leaves the current lines alone.)
+    if (lr->same && lr->seen > 0 && lr->seen < st->line_count) {
+        live_collect_prefix(st, (size_t)lr->seen);
+    }
+
+    int new_count = fresh->count;
+    if (lr->same || lr->failed || new_count == 0 || !ensure_line_capacity(st, new_count)) {
+        line_store_clear(fresh);
+        free(lr->hashes);
+        lr->hashes = NULL;
+        return 0;
+    }
+    uint64_t *hashes = lr->hashes;
+    lr->hashes = NULL;
+
+    int reuse = matcher_current(st) && st->live_hash_count == st->line_count &&
+                !(st->match_mode == MATCH_REGEX && st->regex_valid < 0);
+    int old_count = st->line_count;
+    int old_selected = -1;
+    if (st->match_count > 0 && st->selected >= 0 && st->selected < st->match_count) {
+        old_selected = st->match_indices[st->selected];
+    }
+
+    // Scores only mean something for lines in the result set; anything else
+    // may be left over from an older query.
+    int *old_score = NULL;
+    if (reuse) {
+        old_score = (int*)malloc((size_t)(old_count > 0 ? old_count : 1) * sizeof(int));
+        if (old_score) {
+            for (int i = 0; i < old_count; i++) old_score[i] = SCORE_NONE;
+            for (int m = 0; m < st->match_count; m++) {
+                int idx = st->match_indices[m];
+                old_score[idx] = st->scores[idx];
+            }
+        }
+    }
+
+    matcher_stop(st);
+    st->store_gen++;
+    LineStore tmp = st->store;
+    st->store = st->spare_store;
+    st->spare_store = tmp;
+    st->line_count = new_count;
+
+    for (int j = 0; j < new_count && !st->ansi_render; j++) {
+        const LineRec *rec = store_rec(&st->store, j);
+        if (rec->plain_len != rec->raw_len) st->ansi_render = 1;
+    }
+
+    int *old_to_new = (int*)malloc((size_t)(old_count > 0 ? old_count : 1) * sizeof(int));
+    int *new_to_old = (int*)malloc((size_t)new_count * sizeof(int));
+    int diffed = old_to_new && new_to_old && st->live_hash_count == old_count &&
+                 live_diff(&st->spare_store, st->live_hashes, old_count,
+                           &st->store, hashes, new_count, old_to_new, new_to_old);
+
+    if (!(diffed && old_score && live_rescore(st, new_to_old, old_score))) {
+        update_matches(st);
+    }
+
+    // Follow the selected line; if it went away, land on the next line after
+    // it that survived.
+    int target = -1;
+    for (int i = old_selected; diffed && i >= 0 && i < old_count && target < 0; i++) {
+        target = old_to_new[i];
+    }
+
+    st->selected = 0;
+    st->scroll_offset = 0;
+    for (int m = 0; target >= 0 && m < st->match_count; m++) {
+        if (st->match_indices[m] != target) continue;
+        // Already in its final place (an empty query keeps input order), or
+        // only a prefix is ranked: work out where the line lands in the final
+        // order and rank up to it.
+        int rank = m;
+        if (m >= st->sorted_count) {
+            rank = 0;
+            for (int k = 0; k < st->match_count; k++) {
+                if (compare_scores(&st->match_indices[k], &target, st) < 0) rank++;
+            }
+            ensure_sorted(st, rank + 1);
+        }
+        st->selected = rank;
+        ensure_visible(st);
+        break;
+    }
+
+    line_store_clear(&st->spare_store);
+    free(st->live_hashes);
+    st->live_hashes = hashes;
+    st->live_hash_count = new_count;
+
+    free(old_score);
+    free(old_to_new);
+    free(new_to_old);
+    return 1;
+}
+
+// Blocking refresh, for --filter: runs the command to completion.
+static void refresh_live_command(FuzzyState *st) {
+    if (!st->live_mode || !st->live_cmd || !st->live_cmd[0]) return;
+
+    FILE *fp = popen(st->live_cmd, "r");
+    if (!fp) return;
+
+    LineReader r;
+    if (!line_reader_open(&r, fp)) {
+        pclose(fp);
+        return;
+    }
+
+    live_collect_begin(st);
+    char *line;
+    size_t len;
+    while ((line = line_reader_next(&r, &len)) != NULL) {
+        live_collect_line(st, line, len);
+    }
+    line_reader_close(&r);
+    pclose(fp);
+
+    live_collect_end(st);
 }
 
-static void toggle_exact_mode(FuzzyState *st) {
-    if (st->match_mode == MATCH_EXACT) st->match_mode = MATCH_FUZZY;
-    else st->match_mode = MATCH_EXACT;
-
-    if (st->regex_valid > 0) {
-        regfree(&st->regex);
-        st->regex_valid = 0;
+// Waits for earlier runs that had closed their output but not yet exited.
+static void live_reap(LiveRun *lr) {
+    int kept = 0;
+    for (int i = 0; i < lr->reap_count; i++) {
+        if (waitpid(lr->reap[i], NULL, WNOHANG) == 0) lr->reap[kept++] = lr->reap[i];
     }
-    update_matches(st);
+    lr->reap_count = kept;
 }
 
-static void toggle_fuzzy_mode(FuzzyState *st) {
-    if (st->match_mode == MATCH_FUZZY) st->match_mode = MATCH_EXACT;
-    else st->match_mode = MATCH_FUZZY;
+// Starts the --live command as a child in its own process group with its
+// output on a non-blocking pipe; live_poll reads it from the main loop.
+// Never overlaps runs: a no-op while the previous one is still going.
+static void live_start(FuzzyState *st) {
+    LiveRun *lr = &st->live;
+    if (lr->pid > 0 || !st->live_mode || !st->live_cmd || !st->live_cmd[0]) return;
 
-    if (st->regex_valid > 0) {
-        regfree(&st->regex);
-        st->regex_valid = 0;
+    live_reap(lr);
+
+    int fds[2];
+    if (pipe(fds) != 0) return;
+    fcntl(fds[0], F_SETFD, FD_CLOEXEC);
+    fcntl(fds[1], F_SETFD, FD_CLOEXEC);
+
+    pid_t pid = fork();
+    if (pid < 0) {
+        close(fds[0]);
+        close(fds[1]);
+        return;
     }
-    update_matches(st);
+    if (pid == 0) {
+        setpgid(0, 0);
+        dup2(fds[1], STDOUT_FILENO);
+        execl("/bin/sh", "sh", "-c", st->live_cmd, (char*)NULL);
+        _exit(127);
+    }
+    // Set it from this side too, so kill(-pid) can't run ahead of the child.
+    setpgid(pid, pid);
+
+    close(fds[1]);
+    fcntl(fds[0], F_SETFL, fcntl(fds[0], F_GETFL) | O_NONBLOCK);
+
+    lr->out = fdopen(fds[0], "r");
+    if (!lr->out || !line_reader_open(&lr->reader, lr->out)) {
+        if (lr->out) fclose(lr->out);
+        else close(fds[0]);
+        lr->out = NULL;
+        kill(-pid, SIGTERM);
+        waitpid(pid, NULL, 0);
+        return;
+    }
+
+    lr->pid = pid;
+    lr->started_ms = now_ms();
+    live_collect_begin(st);
 }
 
-static void toggle_regex_mode(FuzzyState *st) {
-    if (st->match_mode == MATCH_REGEX) {
-        if (st->regex_valid > 0) {
-            regfree(&st->regex);
-            st->regex_valid = 0;
+static void live_close(LiveRun *lr) {
+    line_reader_close(&lr->reader);
+    fclose(lr->out);
+    lr->out = NULL;
+
+    // Output is closed, but the command may linger a moment before exiting.
+    if (waitpid(lr->pid, NULL, WNOHANG) == 0) {
+        if (lr->reap_count == lr->reap_cap) {
+            int cap = lr->reap_cap ? lr->reap_cap * 2 : 4;
+            pid_t *grown = (pid_t*)realloc(lr->reap, (size_t)cap * sizeof(pid_t));
+            if (grown) {
+                lr->reap = grown;
+                lr->reap_cap = cap;
+            }
         }
-        st->match_mode = MATCH_FUZZY;
-    } else {
-        if (st->regex_valid > 0) {
-            regfree(&st->regex);
+        if (lr->reap_count < lr->reap_cap) {
+            lr->reap[lr->reap_count++] = lr->pid;
+        } else {
+            // Nowhere to remember it: end it now rather than leak a zombie.
+            kill(-lr->pid, SIGKILL);
+            waitpid(lr->pid, NULL, 0);
         }
-        st->match_mode = MATCH_REGEX;
-        st->regex_valid = 0;
     }
-    update_matches(st);
+    lr->pid = 0;
 }
 
-static void store_input_files(FuzzyState *st, int argc, char **argv, int first_file_idx) {
-    if (first_file_idx >= argc) {
-        st->input_file_count = 0;
-        st->input_files = NULL;
-        return;
+// Takes in what the running command has written so far. Once it closes its
+// output the refresh is applied and the next run is scheduled: interval
+// after this one ended, doubled for each run in a row that changed nothing
+// (up to LIVE_BACKOFF_MAX_SHIFT times), and never sooner than the command
+// takes to run, so a slow command can't keep a core busy. Returns 1 if the
+// lines changed.
+static int live_poll(FuzzyState *st) {
+    LiveRun *lr = &st->live;
+    if (lr->pid <= 0) return 0;
+
+    char *line;
+    size_t len;
+    int budget = LIVE_POLL_LINES;
+    while (budget-- > 0 && (line = line_reader_next(&lr->reader, &len)) != NULL) {
+        live_collect_line(st, line, len);
     }
+    if (!lr->reader.eof) return 0;
+
+    long now = now_ms();
+    live_close(lr);
+    lr->run_ms = now - lr->started_ms;
+
+    int changed = live_collect_end(st);
+    lr->idle_runs = changed ? 0 : lr->idle_runs + 1;
+
+    int shift = lr->idle_runs < LIVE_BACKOFF_MAX_SHIFT ? lr->idle_runs : LIVE_BACKOFF_MAX_SHIFT;
+    long delay = (long)st->live_interval_ms << shift;
+    if (delay < lr->run_ms) delay = lr->run_ms;
+    if (lr->rerun) delay = 0;
+    lr->rerun = 0;
+    lr->delay_ms = delay;
+    lr->next_ms = now + delay;
+    return changed;
+}
 
-    int count = argc - first_file_idx;
-    st->input_files = (char**)calloc((size_t)count, sizeof(char*));
-    if (!st->input_files) {
-        fprintf(stderr, "Warning: failed to allocate memory for file list\n");
-        st->input_file_count = 0;
-        return;
-    }
+// Starts a run when one is due. Returns how long the main loop may sleep
+// before something live needs attention, or -1 for no limit.
+static int live_tick(FuzzyState *st) {
+    LiveRun *lr = &st->live;
+    if (!st->live_mode) return -1;
 
-    st->input_file_count = 0;
-    for (int i = first_file_idx; i < argc; i++) {
-        st->input_files[st->input_file_count] = strdup(argv[i]);
-        if (st->input_files[st->input_file_count]) {
-            st->input_file_count++;
-        }
+    long now = now_ms();
+    if (lr->pid <= 0 && now >= lr->next_ms) live_start(st);
+
+    // While running, wake now and then so the elapsed time on the status
+    // bar keeps moving.
+    if (lr->pid > 0) return LIVE_STATUS_TICK_MS;
+    long left = lr->next_ms - now;
+    return left > 0 ? (int)left : 0;
+}
+
+// On exit: stop a run in progress, the whole pipeline with it.
+static void live_stop(FuzzyState *st) {
+    LiveRun *lr = &st->live;
+    if (lr->pid > 0) {
+        kill(-lr->pid, SIGTERM);
+        live_close(lr);
     }
+    free(lr->hashes);
+    lr->hashes = NULL;
+    free(lr->reap);
+    lr->reap = NULL;
+    lr->reap_count = lr->reap_cap = 0;
+}
+
+// Walks the -R tree again from scratch. A walk still in progress is left to
+// finish first.
+static void refresh_walk(FuzzyState *st) {
+    Ingest *in = &st->ingest;
+    if (in->active) return;
+
+    int old_line_count;
+    line_store_begin_reload(st, &old_line_count);
+    line_store_end_reload(st, 1, old_line_count);
+
+    in->done = 0;
+    in->bytes = 0;
+    in->finished_ms = 0;
+    update_matches(st);
+    st->selected = 0;
+    st->scroll_offset = 0;
+    ingest_start(st);
 }
 
 static void refresh_source(FuzzyState *st) {
     if (st->live_mode) {
-        refresh_live_command(st);
+        // Rerun right away, or as soon as the current run finishes.
+        st->live.idle_runs = 0;
+        st->live.rerun = st->live.pid > 0;
+        live_start(st);
         return;
     }
 
-    int old_line_count = st->line_count;
-    char **old_lines = NULL;
-    char **old_raw_lines = NULL;
+    if (st->walk.root) {
+        refresh_walk(st);
+        return;
+    }
 
-    if (st->line_count > 0) {
-        old_lines = (char**)calloc((size_t)st->line_count, sizeof(char*));
-        old_raw_lines = (char**)calloc((size_t)st->line_count, sizeof(char*));
-        if (old_lines && old_raw_lines) {
-            for (int i = 0; i < st->line_count; i++) {
-                old_lines[i] = st->lines[i];
-                old_raw_lines[i] = st->raw_lines[i];
-            }
-        } else {
-            free(old_lines);
-            free(old_raw_lines);
-            old_lines = NULL;
-            old_raw_lines = NULL;
-        }
+    if (st->grep_mode) {
+        grep_restart(st);
+        return;
     }
 
-    st->line_count = 0;
+    // stdin cannot be re-read, and with no source there is nothing to reload.
+    if (!st->is_directory_mode && (st->from_stdin || st->input_file_count <= 0 || !st->input_files)) {
+        return;
+    }
+    // The reader thread still owns the store; let the first load finish.
+    if (st->ingest.active) return;
+
+    int old_line_count;
+    line_store_begin_reload(st, &old_line_count);
 
     int success = 0;
 
     if (st->is_directory_mode) {
-if (st->is_directory_mode) {
-    if (st->ssh_mode) {
-        resolve_remote_tilde_inplace(st);
-        load_ssh_directory(st, st->current_dir);
-    } else {
-        load_directory(st, st->current_dir);
-    }
-}
-        else load_directory(st, st->current_dir);
-        success = (st->line_count > 0);
-
-    } else if (st->from_stdin) {
-        if (old_lines && old_raw_lines) {
-            for (int i = 0; i < old_line_count; i++) {
-                st->lines[i] = old_lines[i];
-                st->raw_lines[i] = old_raw_lines[i];
-            }
-            st->line_count = old_line_count;
-            free(old_lines);
-            free(old_raw_lines);
+        if (st->ssh_mode) {
+            dir_cache_invalidate(st);
+            resolve_remote_tilde_inplace(st);
+            load_ssh_directory(st, st->current_dir);
+        } else {
+            load_directory(st, st->current_dir);
         }
-        return;
+        success = (st->line_count > 0);
 
-    } else if (st->input_file_count > 0 && st->input_files) {
-        for (int i = 0; i < st->input_file_count && st->line_count < MAX_LINES; i++) {
+    } else {
+        for (int i = 0; i < st->input_file_count; i++) {
             const char *path = st->input_files[i];
 
             if (strchr(path, ':')) {
@@ -1805,62 +6219,30 @@ if (st->is_directory_mode) {
                 }
             }
 
-            if (st->grep_mode) {
-                load_file_grep(st, path);
+            FILE *fp = fopen(path, "r");
+            if (fp) {
+                load_stream(st, fp);
+                fclose(fp);
                 success = 1;
-            } else {
-                FILE *fp = fopen(path, "r");
-                if (fp) {
-                    load_stream(st, fp);
-                    fclose(fp);
-                    success = 1;
-                }
-            }
-        }
-    } else {
-        if (old_lines && old_raw_lines) {
-            for (int i = 0; i < old_line_count; i++) {
-                st->lines[i] = old_lines[i];
-                st->raw_lines[i] = old_raw_lines[i];
             }
-            st->line_count = old_line_count;
-            free(old_lines);
-            free(old_raw_lines);
         }
-        return;
     }
 
-    if (success && old_lines && old_raw_lines) {
-        for (int i = 0; i < old_line_count; i++) {
-            free(old_lines[i]);
-            free(old_raw_lines[i]);
-        }
-        free(old_lines);
-        free(old_raw_lines);
-    } else if (!success && old_lines && old_raw_lines) {
-        for (int i = 0; i < st->line_count; i++) {
-            free(st->lines[i]);
-            free(st->raw_lines[i]);
-            st->lines[i] = NULL;
-            st->raw_lines[i] = NULL;
-        }
-        for (int i = 0; i < old_line_count; i++) {
-            st->lines[i] = old_lines[i];
-            st->raw_lines[i] = old_raw_lines[i];
-        }
-        st->line_count = old_line_count;
-        free(old_lines);
-        free(old_raw_lines);
-        return;
-    }
+    line_store_end_reload(st, success, old_line_count);
+    if (!success) return;
 
     update_matches(st);
     st->selected = 0;
     st->scroll_offset = 0;
-    clear();
 }
 
 static void toggle_hidden_files(FuzzyState *st) {
+    if (st->walk.root) {
+        if (st->ingest.active) return;
+        st->show_hidden = !st->show_hidden;
+        refresh_walk(st);
+        return;
+    }
     if (!st->is_directory_mode) return;
 
     st->show_hidden = !st->show_hidden;
@@ -1872,8 +6254,6 @@ static void toggle_hidden_files(FuzzyState *st) {
 
     st->selected = 0;
     st->scroll_offset = 0;
-
-    clear();
 }
 
 static void navigate_directory(FuzzyState *st, const char *selection) {
@@ -1923,21 +6303,26 @@ static void navigate_directory(FuzzyState *st, const char *selection) {
 static void handle_resize(FuzzyState *st) {
     resizeterm(0, 0);
     ensure_visible(st);
-    clear();
+    invalidate_screen(st);
+    clearok(curscr, TRUE);
     draw_ui(st);
 }
 
-static int handle_input(FuzzyState *st, int *running) {
-    int ch = getch();
-
+static int handle_input(FuzzyState *st, int ch, int *running) {
     switch (ch) {
-        case ERR:
-            return -2;
         case KEY_RESIZE:
             handle_resize(st);
             return -2;
+        case 20:
+            st->perf.overlay = !st->perf.overlay;
+            return -2;
     }
 
+    // Keystroke latency runs until the frame that shows its effect is drawn,
+    // which with the matcher or a -G search running is the first one after
+    // their results are in. Keys typed meanwhile count from the oldest.
+    if (!st->perf.key_start_us) st->perf.key_start_us = now_us();
+
     if (st->mode == MODE_NORMAL) {
         switch (ch) {
             case 'i':
@@ -1956,9 +6341,11 @@ static int handle_input(FuzzyState *st, int *running) {
             case '\n':
             case '\r':
             case KEY_ENTER:
+                // Act on the results for what was typed, not on a stale frame.
+                if (!matcher_current(st)) update_matches(st);
                 if (st->is_directory_mode && st->match_count > 0 && st->selected < st->match_count) {
                     int line_idx = st->match_indices[st->selected];
-                    const char *selection = st->lines[line_idx];
+                    const char *selection = line_plain(st, line_idx);
 
                     if (selection && strlen(selection) > 0 &&
                         (selection[strlen(selection) - 1] == '/' ||
@@ -2036,9 +6423,11 @@ static int handle_input(FuzzyState *st, int *running) {
             case '\n':
             case '\r':
             case KEY_ENTER:
+                // Act on the results for what was typed, not on a stale frame.
+                if (!matcher_current(st)) update_matches(st);
                 if (st->is_directory_mode && st->match_count > 0 && st->selected < st->match_count) {
                     int line_idx = st->match_indices[st->selected];
-                    const char *selection = st->lines[line_idx];
+                    const char *selection = line_plain(st, line_idx);
 
                     if (selection && strlen(selection) > 0 &&
                         (selection[strlen(selection) - 1] == '/' ||
@@ -2093,6 +6482,79 @@ static int handle_input(FuzzyState *st, int *running) {
     return -2;
 }
 
+static void init_colors(void) {
+    if (has_colors()) {
+        start_color();
+        use_default_colors();
+
+        init_pair(COLOR_NORMAL,     COLOR_WHITE,   -1);
+        init_pair(COLOR_SELECTED,   COLOR_WHITE,   -1);
+        init_pair(COLOR_MATCH,      COLOR_YELLOW,  -1);
+        init_pair(COLOR_STATUS,     COLOR_WHITE,   -1);
+        init_pair(COLOR_QUERY,      COLOR_CYAN,    -1);
+        init_pair(COLOR_EXECUTABLE, COLOR_GREEN,   -1);
+        init_pair(COLOR_ERROR,      COLOR_RED,     -1);
+
+        short map8[8] = {
+            COLOR_BLACK, COLOR_RED, COLOR_GREEN, COLOR_YELLOW,
+            COLOR_BLUE,  COLOR_MAGENTA, COLOR_CYAN, COLOR_WHITE
+        };
+
+        for (int i = 0; i < 8; i++) {
+            init_pair(ANSI_PAIR_BASE + i,     map8[i], -1);
+            init_pair(ANSI_PAIR_BASE + 8 + i, map8[i], -1);
+        }
+    }
+}
+
+// --filter: load everything, rank once and print the matches best first.
+// Exit status follows grep: 0 if anything matched, 1 if not, 2 on error.
+static int run_filter(FuzzyState *st) {
+    ingest_read_all(st);
+    ingest_close_sources(st);
+
+    update_matches(st);
+
+    if (st->match_mode == MATCH_REGEX && st->regex_valid < 0) {
+        fprintf(stderr, "Error: invalid regex: %s\n", st->regex_error);
+        return 2;
+    }
+
+    if (st->count_only) {
+        printf("%d\n", st->match_count);
+        return st->match_count > 0 ? 0 : 1;
+    }
+
+    int n = st->match_count;
+    if (st->filter_limit > 0 && st->filter_limit < n) n = st->filter_limit;
+    ensure_sorted(st, n);
+
+    for (int i = 0; i < n; i++) {
+        int idx = st->match_indices[i];
+        fwrite(line_plain(st, idx), 1, store_rec(&st->store, idx)->plain_len, stdout);
+        putchar('\n');
+    }
+
+    if (fflush(stdout) != 0) return 2;
+    return st->match_count > 0 ? 0 : 1;
+}
+
+// --stats: cumulative percentiles for the session, on stderr.
+static void print_stats(FuzzyState *st) {
+    Perf *p = &st->perf;
+    LatencyLog *logs[3] = { &p->keys, &p->updates, &p->frames };
+    const char *names[3] = { "keystroke", "match", "frame" };
+
+    fprintf(stderr, "ff stats: %d lines\n", st->line_count);
+    for (int i = 0; i < 3; i++) {
+        int n = logs[i]->count;
+        double p50 = latency_percentile_ms(logs[i], 50);
+        double p99 = latency_percentile_ms(logs[i], 99);
+        double max = n > 0 ? logs[i]->us[n - 1] / 1000.0 : 0.0;
+        fprintf(stderr, "  %-10s n=%d p50=%.3fms p99=%.3fms max=%.3fms\n", names[i], n, p50, p99, max);
+    }
+}
+
 static int parse_flags(int argc, char **argv, FuzzyState *st) {
     int i = 1;
 
@@ -2125,14 +6587,6 @@ static int parse_flags(int argc, char **argv, FuzzyState *st) {
         } else if (strcmp(argv[i], "-G") == 0) {
             st->grep_mode = 1;
 
-            if (!st->line_numbers) {
-                st->line_numbers = (int*)calloc(MAX_LINES, sizeof(int));
-                if (!st->line_numbers) {
-                    fprintf(stderr, "Failed to allocate line numbers array\n");
-                    return -1;
-                }
-            }
-
         } else if (strcmp(argv[i], "-D") == 0) {
             st->is_directory_mode = 1;
 
@@ -2166,6 +6620,44 @@ static int parse_flags(int argc, char **argv, FuzzyState *st) {
                 }
             }
 
+        } else if (strcmp(argv[i], "-R") == 0) {
+            const char *root = ".";
+            if (i + 1 < argc && argv[i + 1][0] != '-') root = argv[++i];
+
+            free(st->walk.root);
+            st->walk.root = strdup(root);
+            if (!st->walk.root) {
+                fprintf(stderr, "Error: out of memory\n");
+                return -1;
+            }
+
+        } else if (strcmp(argv[i], "--depth") == 0) {
+            if (i + 1 >= argc) {
+                fprintf(stderr, "Error: --depth requires a number of levels\n");
+                return -1;
+            }
+
+            int n = atoi(argv[++i]);
+            st->walk.max_depth = n > 0 ? n : 0;
+
+        } else if (strcmp(argv[i], "--exclude") == 0) {
+            if (i + 1 >= argc) {
+                fprintf(stderr, "Error: --exclude requires a pattern\n");
+                return -1;
+            }
+
+            char **excludes = (char**)realloc(st->walk.excludes,
+                                              (size_t)(st->walk.exclude_count + 1) * sizeof(char*));
+            if (!excludes) {
+                fprintf(stderr, "Error: out of memory\n");
+                return -1;
+            }
+            st->walk.excludes = excludes;
+            st->walk.excludes[st->walk.exclude_count++] = argv[++i];
+
+        } else if (strcmp(argv[i], "--hidden") == 0) {
+            st->show_hidden = 1;
+
         } else if (strcmp(argv[i], "--live") == 0) {
             if (i + 1 >= argc) {
                 fprintf(stderr, "Error: --live requires a command string\n");
@@ -2190,6 +6682,67 @@ static int parse_flags(int argc, char **argv, FuzzyState *st) {
             if (ms < 50) ms = 50;
             st->live_interval_ms = ms;
 
+        } else if (strcmp(argv[i], "--algo") == 0 || strncmp(argv[i], "--algo=", 7) == 0) {
+            const char *name = argv[i][6] == '=' ? argv[i] + 7 : NULL;
+            if (!name) {
+                if (i + 1 >= argc) {
+                    fprintf(stderr, "Error: --algo requires v1 or v2\n");
+                    return -1;
+                }
+                name = argv[++i];
+            }
+
+            if (strcmp(name, "v1") == 0) st->algo = ALGO_V1;
+            else if (strcmp(name, "v2") == 0) st->algo = ALGO_V2;
+            else {
+                fprintf(stderr, "Error: unknown --algo '%s' (expected v1 or v2)\n", name);
+                return -1;
+            }
+
+        } else if (strcmp(argv[i], "--filter") == 0) {
+            if (i + 1 >= argc) {
+                fprintf(stderr, "Error: --filter requires a query\n");
+                return -1;
+            }
+
+            const char *q = argv[++i];
+            size_t len = strlen(q);
+            if (len >= sizeof(st->query)) {
+                fprintf(stderr, "Error: --filter query is longer than %d bytes\n",
+                        (int)sizeof(st->query) - 1);
+                return -1;
+            }
+            memcpy(st->query, q, len + 1);
+            st->query_len = (int)len;
+            st->filter_mode = 1;
+
+        } else if (strcmp(argv[i], "--limit") == 0) {
+            if (i + 1 >= argc) {
+                fprintf(stderr, "Error: --limit requires a count\n");
+                return -1;
+            }
+
+            int n = atoi(argv[++i]);
+            st->filter_limit = n > 0 ? n : 0;
+
+        } else if (strcmp(argv[i], "--count") == 0) {
+            st->count_only = 1;
+            st->filter_mode = 1;
+
+        } else if (strcmp(argv[i], "--stats") == 0) {
+            st->perf.enabled = 1;
+
+        } else if (strcmp(argv[i], "--threads") == 0) {
+            if (i + 1 >= argc) {
+                fprintf(stderr, "Error: --threads requires a count\n");
+                return -1;
+            }
+
+            int n = atoi(argv[++i]);
+            if (n < 1) n = 1;
+            if (n > POOL_MAX_THREADS) n = POOL_MAX_THREADS;
+            st->threads = n;
+
         } else if (argv[i][0] == '-') {
             fprintf(stderr, "Unknown option: %s\n", argv[i]);
             usage(argv[0]);
@@ -2205,7 +6758,7 @@ static int parse_flags(int argc, char **argv, FuzzyState *st) {
 
 int main(int argc, char **argv) {
     setlocale(LC_ALL, "");
-    char output[256];
+    simd_init();
 
     FuzzyState *st = (FuzzyState*)calloc(1, sizeof(FuzzyState));
     if (!st) {
@@ -2226,10 +6779,12 @@ int main(int argc, char **argv) {
     st->ssh_mode = 0;
     st->current_dir[0] = '\0';
     st->match_mode = MATCH_FUZZY;
+    st->algo = ALGO_V1;
+    st->span_gen = 1;
+    st->dir_fd = -1;
     st->regex_valid = 0;
     st->regex_error[0] = '\0';
     st->grep_mode = 0;
-    st->line_numbers = NULL;
     st->source_files = NULL;
     st->input_files = NULL;
     st->input_file_count = 0;
@@ -2237,7 +6792,6 @@ int main(int argc, char **argv) {
     st->live_mode = 0;
     st->live_cmd = NULL;
     st->live_interval_ms = 1000;
-    st->last_live_refresh_ms = 0;
     st->ansi_render = 0;
 
     int first_file_idx = parse_flags(argc, argv, st);
@@ -2246,27 +6800,27 @@ int main(int argc, char **argv) {
         return 0;
     }
 
-    st->scores = (int*)calloc(MAX_LINES, sizeof(int));
-    st->match_indices = (int*)calloc(MAX_LINES, sizeof(int));
-    if (!st->scores || !st->match_indices) {
-        fprintf(stderr, "Failed to allocate memory\n");
-        free(st->scores);
-        free(st->match_indices);
-        free(st->line_numbers);
-        free(st);
-        return 1;
-    }
-
     if (st->is_directory_mode) {
         if (st->ssh_mode) load_ssh_directory(st, st->current_dir);
         else load_directory(st, st->current_dir);
 
     } else if (st->live_mode) {
-        refresh_live_command(st);
+        // Interactive runs start the command from the main loop instead, so
+        // the UI is up before the first output arrives.
+        if (st->filter_mode) refresh_live_command(st);
+
+    } else if (st->walk.root) {
+        if (!walk_open_root(st)) {
+            free_state(st);
+            free(st);
+            return 1;
+        }
 
-    } else if (!isatty(STDIN_FILENO)) {
+    } else if (!isatty(STDIN_FILENO) && first_file_idx >= argc) {
+        // File arguments win over a non-tty stdin: under cron or CI stdin is
+        // rarely a terminal even when nothing is piped in.
         st->from_stdin = 1;
-        load_stdin(st);
+        ingest_add_source(st, stdin, 0);
 
     } else {
         if (first_file_idx >= argc) {
@@ -2280,8 +6834,13 @@ int main(int argc, char **argv) {
         store_input_files(st, argc, argv, first_file_idx);
 
         int ok;
-        if (st->grep_mode) ok = load_files_grep(st, argc, argv, first_file_idx);
-        else ok = load_files(st, argc, argv, first_file_idx);
+        if (st->grep_mode) {
+            // Nothing is read until there is a query to search for.
+            ok = grep_open_files(st);
+            if (ok) grep_prepare(st);
+        } else {
+            ok = ingest_open_files(st, argc, argv, first_file_idx);
+        }
 
         if (!ok) {
             fprintf(stderr, "nfzf: no readable input files.\n");
@@ -2291,7 +6850,16 @@ int main(int argc, char **argv) {
         }
     }
 
-    if (st->line_count == 0) {
+    if (st->filter_mode) {
+        int rc = run_filter(st);
+        if (st->perf.enabled) print_stats(st);
+        free_state(st);
+        free(st);
+        return rc;
+    }
+
+    if (st->line_count == 0 && st->ingest.source_count == 0 && !st->walk.root && !st->live_mode &&
+        !st->grep_mode) {
         fprintf(stderr, "No input lines\n");
         free_state(st);
         free(st);
@@ -2299,6 +6867,8 @@ int main(int argc, char **argv) {
     }
 
     update_matches(st);
+    ingest_start(st);
+    matcher_start(st);
 
     FILE *tty_in  = fopen("/dev/tty", "r");
     FILE *tty_out = fopen("/dev/tty", "w");
@@ -2329,52 +6899,71 @@ int main(int argc, char **argv) {
     cbreak();
     noecho();
     keypad(stdscr, TRUE);
+    idlok(stdscr, TRUE);
     curs_set(0);
 
-    if (st->live_mode) timeout(50);
-    else timeout(-1);
-
-    if (has_colors()) {
-        start_color();
-        use_default_colors();
-
-        init_pair(COLOR_NORMAL,     COLOR_WHITE,   -1);
-        init_pair(COLOR_SELECTED,   COLOR_WHITE,   -1);
-        init_pair(COLOR_MATCH,      COLOR_YELLOW,  -1);
-        init_pair(COLOR_STATUS,     COLOR_WHITE,   -1);
-        init_pair(COLOR_QUERY,      COLOR_CYAN,    -1);
-        init_pair(COLOR_EXECUTABLE, COLOR_GREEN,   -1);
-        init_pair(COLOR_ERROR,      COLOR_RED,     -1);
-
-        short map8[8] = {
-            COLOR_BLACK, COLOR_RED, COLOR_GREEN, COLOR_YELLOW,
-            COLOR_BLUE,  COLOR_MAGENTA, COLOR_CYAN, COLOR_WHITE
-        };
 
-        for (int i = 0; i < 8; i++) {
-            init_pair(ANSI_PAIR_BASE + i,     map8[i], -1);
-            init_pair(ANSI_PAIR_BASE + 8 + i, map8[i], -1);
-        }
-    }
+    init_colors();
 
     int running = 1;
     int result = -1;
 
     while (running) {
-        draw_ui(st);
+        // A scan cancelled by keys handled while it was still running only
+        // comes back now, so the one they asked for starts here.
+        matcher_poll(st);
+        matcher_kick(st);
+        ingest_poll(st);
+        live_poll(st);
+
+        if (!st->ingest.active && st->line_count == 0 && !st->live_mode && !st->is_directory_mode &&
+            !st->grep_mode) {
+            result = -1;
+            break;
+        }
 
-        int r = handle_input(st, &running);
-        if (!running) { result = r; break; }
+        draw_ui(st);
 
-        if (st->live_mode) {
-            long t = now_ms();
-            if (st->last_live_refresh_ms == 0) st->last_live_refresh_ms = t;
+        if (st->perf.key_start_us && matcher_current(st) &&
+            !(st->grep_mode && (st->ingest.active || st->grep.want != st->grep.started))) {
+            if (st->perf.enabled) latency_record(&st->perf.keys, now_us() - st->perf.key_start_us);
+            st->perf.key_start_us = 0;
+        }
 
-            if (t - st->last_live_refresh_ms >= st->live_interval_ms) {
-                refresh_live_command(st);
-                st->last_live_refresh_ms = t;
-            }
+        // Sleep until a key, a finished scan, newly read lines or --live
+        // output arrives, or until the earliest timer is due: the prefetch
+        // debounce, the next --live run or the ingest frame. Idle, nothing
+        // wakes us at all. The drain below leaves ncurses with nothing
+        // buffered, so poll() on the tty sees every key.
+        int ingest_fd;
+        int wait_ms = ingest_wait(st, &ingest_fd);
+        int prefetch_ms = dir_prefetch_tick(st);
+        if (prefetch_ms >= 0 && (wait_ms < 0 || prefetch_ms < wait_ms)) wait_ms = prefetch_ms;
+        int live_ms = live_tick(st);
+        if (live_ms >= 0 && (wait_ms < 0 || live_ms < wait_ms)) wait_ms = live_ms;
+
+        struct pollfd fds[4];
+        int nfds = 0;
+        fds[nfds++] = (struct pollfd){ fileno(tty_in), POLLIN, 0 };
+        if (st->matcher.busy) fds[nfds++] = (struct pollfd){ st->matcher.wake[0], POLLIN, 0 };
+        if (ingest_fd >= 0) fds[nfds++] = (struct pollfd){ ingest_fd, POLLIN, 0 };
+        if (st->live.pid > 0) fds[nfds++] = (struct pollfd){ st->live.reader.fd, POLLIN, 0 };
+        if (wait_ms != 0) poll(fds, (nfds_t)nfds, wait_ms);
+        timeout(0);
+
+        // Take everything already typed before matching again, so a burst of
+        // keys or a paste costs one scan instead of one per character.
+        int ch = getch();
+        while (ch != ERR && running) {
+            int r = handle_input(st, ch, &running);
+            if (!running) result = r;
+            timeout(0);
+            ch = getch();
         }
+        if (!running) break;
+
+        matcher_kick(st);
+        grep_kick(st);
     }
 
     endwin();
@@ -2382,15 +6971,30 @@ int main(int argc, char **argv) {
     fclose(tty_in);
     fclose(tty_out);
 
+    if (st->line_count == 0 && !st->ingest.active && !st->live_mode && !st->is_directory_mode &&
+        !st->grep_mode) {
+        fprintf(stderr, "No input lines\n");
+    }
+
+    if (st->perf.enabled) print_stats(st);
+
     if (result >= 0 && result < st->match_count) {
         int line_idx = st->match_indices[result];
-        const char *selected = st->lines[line_idx];
-
-        strncpy(output, selected ? selected : "", sizeof(output) - 1);
-        output[sizeof(output) - 1] = '\0';
+        // Lines have no length limit any more, so copy rather than truncate.
+        char *output = strdup(line_plain(st, line_idx));
+        if (!output) {
+            fprintf(stderr, "Failed to allocate memory\n");
+            free_state(st);
+            free(st);
+            return 1;
+        }
 
+        // Drop the type suffix the listing added: '/' on directories, and
+        // '*' on executables only in remote listings, where it is part of
+        // the entry text rather than drawn.
         size_t len = strlen(output);
-        if (len > 0 && (output[len - 1] == '/' || output[len - 1] == '*')) {
+        if (st->is_directory_mode && len > 0 &&
+            (output[len - 1] == '/' || (st->ssh_mode && output[len - 1] == '*'))) {
             output[len - 1] = '\0';
         }
 
@@ -2423,6 +7027,8 @@ int main(int argc, char **argv) {
         } else {
             printf("%s\n", output);
         }
+
+        free(output);
     }
 
     free_state(st);